@@ -109,6 +109,10 @@ int main()
     solver.set_max_slices(10000);
     solver.set_refining_mode(0);
     solver.set_contraction_mode(2);
+    //    solver.set_time_segments(4);  // parallel-in-time contraction
+    //    solver.set_nb_threads(4);
+    //    solver.set_deterministic_search(16);  // same solutions for any number of threads
+    //    solver.set_compact_nodes(true);  // pending nodes without their codomains
     //    solver.figure()->add_trajectoryvector(&truth1, "truth1");
     //    solver.figure()->add_trajectoryvector(&truth2, "truth2");
     list<TubeVector> l_solutions = solver.solve(x, f, &contract);
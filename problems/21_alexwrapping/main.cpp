@@ -59,6 +59,7 @@ int main()
 
     double step=5.;  
     int nbsteps=1;
+    //    ContractionCache cache(100, true);  // autonomous ODE : shared by the windows
     for (int i=0; i< nbsteps; i++){
 
       Vector epsilon(2, 0.4);
@@ -91,6 +92,8 @@ int main()
       solver.set_trace(1);
       solver.set_bisection_timept(-1);
       solver.set_contraction_mode(4);
+      //      solver.set_contraction_cache(&cache);
+      //      solver.set_node_memory_budget(1L<<30);  // pending tubes beyond 1 GB spilled to tubex_nodes.spill
       list<TubeVector> l_solutions = solver.solve(x, f);
     //    cout << "time " << (i+1)*step << " nb sol " << l_solutions.size() << endl;
       if (l_solutions.size()==1) {// cout << " volume " << l_solutions.front().volume() << endl;
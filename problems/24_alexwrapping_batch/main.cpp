@@ -0,0 +1,58 @@
+/** 
+ *  tubex-lib - Examples
+ *  Solver testcase 24 : Alex problem (testcase 21) solved for many initial boxes in one batch
+ *  \date       2020
+ *  \author     Bertrand Neveu
+ */
+
+#include "tubex.h"
+#include "tubex-solve.h"
+
+using namespace std;
+using namespace ibex;
+using namespace tubex;
+
+int main()
+{
+  TFunction f("x1", "x2" ,"(-x2+0.1*x1*(1-x1^2-x2^2);x1+0.1*x2*(1-x1^2-x2^2))");
+  /* =========== PARAMETERS =========== */
+    Tube::enable_syntheses(false);
+    Vector epsilon(2, 0.4);
+    double step=5.;
+    Interval domain(0.,step);
+    int nb_instances=100;
+
+    vector<TubeVector> l_x0;
+    for (int k=0; k< nb_instances; k++){
+      IntervalVector v(2);
+      v[0]=Interval(1.0+0.01*k).inflate(0.1);
+      v[1]=Interval(0.0);
+      TubeVector x(domain, step, 2);
+      x.set(v, domain.lb()); // initial condition
+      l_x0.push_back(x);
+    }
+
+  /* =========== SOLVER =========== */
+
+    tubex::Solver solver(epsilon);
+    solver.set_refining_fxpt_ratio(2.0);
+    solver.set_propa_fxpt_ratio(0.999);
+    solver.set_var3b_propa_fxpt_ratio(0.99999);
+    solver.set_var3b_fxpt_ratio(0.99999);
+    solver.set_var3b_timept(0);
+    solver.set_max_slices(1000);
+    solver.set_refining_mode(0);
+    solver.set_trace(1);
+    solver.set_bisection_timept(-1);
+    solver.set_contraction_mode(4);
+    solver.set_nb_threads(0);  // all the cores
+    vector<SolverResult> results = solver.solve_batch(l_x0, f);
+
+    double volume=0.0;
+    for (int k=0; k< nb_instances; k++){
+      if (results[k].solutions.size()!=1) return EXIT_FAILURE;
+      volume+=results[k].solutions.front().volume();
+    }
+    cout << " total volume " << volume << " batch time " << solver.solving_time << endl;
+    return EXIT_SUCCESS;
+}
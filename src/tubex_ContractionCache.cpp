@@ -0,0 +1,112 @@
+/* ============================================================================
+ *  tubex-lib - ContractionCache class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#include "tubex_ContractionCache.h"
+
+using namespace std;
+using namespace ibex;
+
+namespace tubex
+{
+  ContractionCache::ContractionCache(int capacity, bool autonomous)
+    : m_capacity(capacity), m_autonomous(autonomous)
+  {
+
+  }
+
+  ContractionCache::~ContractionCache()
+  {
+    clear();
+  }
+
+  // an entry of the same length is shifted to the tdomain of x if the problem is autonomous
+  bool ContractionCache::matches(Entry& e, const TubeVector& x) const
+  {
+    if (e.x0->size() != x.size() || e.x0->nb_slices() != x.nb_slices())
+      return false;
+    if (e.x0->tdomain() != x.tdomain())
+      {
+	if (!m_autonomous || e.x0->tdomain().diam() != x.tdomain().diam())
+	  return false;
+	e.x0->shift_tdomain(x.tdomain().lb() - e.x0->tdomain().lb());
+	if (e.x0->tdomain() != x.tdomain()) // rounding of the shift
+	  return false;
+      }
+    return TubeVector::same_slicing(*e.x0, x) && x.is_subset(*e.x0);
+  }
+
+  bool ContractionCache::contract(TubeVector& x)
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (size_t j = 0; j < m_entries.size(); j++)
+      if (matches(m_entries[j], x))
+	{
+	  m_nb_hits++;
+	  const Entry& e = m_entries[j];
+	  if (e.empty)
+	    {
+	      x.set_empty();
+	      return true;
+	    }
+	  for (int i = 0; i < x.size(); i++)
+	    {
+	      for (Slice* s = x[i].first_slice(); s != NULL; s = s->next_slice())
+		{
+		  s->set_envelope(s->codomain() & e.hull[i], false);
+		  s->set_input_gate(s->input_gate() & e.hull[i], false);
+		}
+	      Slice* last = x[i].last_slice();
+	      last->set_output_gate(last->output_gate() & e.hull[i] & e.output_gate[i], false);
+	    }
+	  return true;
+	}
+    return false;
+  }
+
+  void ContractionCache::add(const TubeVector& x0, const TubeVector& x)
+  {
+    if (m_capacity <= 0) return;
+    Entry e = { new TubeVector(x0), x.is_empty() ? IntervalVector(x0.size(), Interval::EMPTY_SET) : x.codomain(),
+		IntervalVector(x0.size(), Interval::EMPTY_SET), x.is_empty() };
+    if (!e.empty)
+      e.output_gate = x(x.tdomain().ub());
+
+    lock_guard<mutex> lock(m_mutex);
+    m_entries.push_back(e);
+    if ((int)m_entries.size() > m_capacity)
+      {
+	delete m_entries.front().x0;
+	m_entries.pop_front();
+      }
+  }
+
+  int ContractionCache::size() const
+  {
+    lock_guard<mutex> lock(m_mutex);
+    return m_entries.size();
+  }
+
+  int ContractionCache::nb_hits() const
+  {
+    lock_guard<mutex> lock(m_mutex);
+    return m_nb_hits;
+  }
+
+  void ContractionCache::clear()
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (size_t j = 0; j < m_entries.size(); j++)
+      delete m_entries[j].x0;
+    m_entries.clear();
+    m_nb_hits = 0;
+  }
+}
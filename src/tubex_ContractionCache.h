@@ -0,0 +1,67 @@
+/* ============================================================================
+ *  tubex-lib - ContractionCache class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#ifndef __TUBEX_CONTRACTIONCACHE_H__
+#define __TUBEX_CONTRACTIONCACHE_H__
+
+#include <deque>
+#include <mutex>
+#include "tubex_TubeVector.h"
+
+namespace tubex
+{
+  /* Results of the first contraction of the solver (Solver::set_contraction_cache), kept from one solving to another,
+     for repeated solvings of the same problem on overlapping initial tubes (sliding windows, parameter sweeps).
+     An entry stores an initial tube x0 with the hull of its contracted codomains and its contracted output gate :
+     a tube x included in x0 (same tdomain and same slicing) can be contracted at once by this enclosure.
+     A cache is only valid for one problem (derivative function and external contractions) : 
+     it is owned by the user, who gives the same cache to the solvers of the same problem.
+     With autonomous set, the entries are also used for tubes shifted in time (the ODE does not depend on t).
+     The cache can be shared by several threads. */
+  class ContractionCache
+  {
+  public:
+
+      /* capacity : maximum number of entries, the oldest ones are forgotten */
+      ContractionCache(int capacity = 100, bool autonomous = false);
+      ~ContractionCache();
+
+      /* x is contracted by the enclosure of the first entry whose initial tube contains x ; returns true if one is found */
+      bool contract(TubeVector& x);
+      /* stores the contraction of x0 into x (empty if x0 has been refuted) */
+      void add(const TubeVector& x0, const TubeVector& x);
+
+      int size() const;
+      int nb_hits() const;
+      void clear();
+
+  protected:
+
+      struct Entry
+      {
+	TubeVector* x0;
+	IntervalVector hull;
+	IntervalVector output_gate;
+	bool empty;
+      };
+
+      bool matches(Entry& e, const TubeVector& x) const;
+
+      int m_capacity;
+      bool m_autonomous;
+      int m_nb_hits = 0;
+      std::deque<Entry> m_entries;
+      mutable std::mutex m_mutex;
+  };
+}
+
+#endif
@@ -0,0 +1,358 @@
+/* ============================================================================
+ *  tubex-lib - DerivativeCache class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#include <cassert>
+#include <algorithm>
+#include "tubex_DerivativeCache.h"
+
+using namespace std;
+using namespace ibex;
+
+namespace tubex
+{
+  DerivativeCache::DerivativeCache()
+  {
+
+  }
+
+  DerivativeCache::~DerivativeCache()
+  {
+    clear();
+    delete m_batch;
+  }
+
+  void DerivativeCache::clear()
+  {
+    delete m_x; m_x = NULL;
+    delete m_v; m_v = NULL;
+    m_f = NULL;
+  }
+
+  void DerivativeCache::reset()
+  {
+    clear();
+    delete m_batch; m_batch = NULL;
+    m_batch_f = NULL;
+    m_nb_evaluated = 0;
+    m_nb_reused = 0;
+  }
+
+  long DerivativeCache::nb_evaluated() const
+  {
+    return m_nb_evaluated;
+  }
+
+  long DerivativeCache::nb_reused() const
+  {
+    return m_nb_reused;
+  }
+
+  /* the kept tube and v are sampled at the new gates of x (their slices are to be evaluated) ;
+     returns false if a gate of the kept tube is no more in x (coarsening) */
+  bool DerivativeCache::align_slicing(const TubeVector& x)
+  {
+    int nb_slices = x.nb_slices();
+    m_ubs.clear();
+    for (const Slice* s = x[0].first_slice(); s != NULL; s = s->next_slice())
+      m_ubs.push_back(s->tdomain().ub());
+    m_dirty.assign(nb_slices, 0);
+    if (m_x->nb_slices() == nb_slices)
+      return TubeVector::same_slicing(*m_x, x);
+
+    // the slices are split in the first dimension, then in the others in the same way
+    for (int i = 0; i < m_x->size() + m_v->size(); i++)
+      {
+	Tube& y = (i < m_x->size()) ? (*m_x)[i] : (*m_v)[i - m_x->size()];
+	Slice* s = y.first_slice();
+	for (int k = 0; k < nb_slices; k++, s = s->next_slice())
+	  {
+	    if (s == NULL || s->tdomain().ub() < m_ubs[k])
+	      return false;
+	    if (s->tdomain().ub() > m_ubs[k])
+	      {
+		y.sample(m_ubs[k], s);
+		m_dirty[k] = 1; m_dirty[k+1] = 1;
+	      }
+	  }
+      }
+    return true;
+  }
+
+  /* the images by f of the boxes of the slice k of x, into image : the codomain box (tdomain, codomains) in image[0..m),
+     the input gate box (t, gates) in image[m..2m). eval_codomain, eval_gate : false if the image is already computed */
+  void DerivativeCache::eval_slice(const TFnc& f, int k, IntervalVector& box, Interval* image, bool eval_codomain, bool eval_gate)
+  {
+    int n = m_x->size();
+    int m = m_v->size();
+    const Slice* const* xs = &m_x_slices[k*n];
+    if (eval_codomain)
+      {
+	box[0] = xs[0]->tdomain();
+	for (int i = 0; i < n; i++) box[i+1] = xs[i]->codomain();
+	IntervalVector codomain = f.eval_vector(box);
+	for (int j = 0; j < m; j++) image[j] = codomain[j];
+      }
+    if (eval_gate)
+      {
+	box[0] = Interval(xs[0]->tdomain().lb());
+	for (int i = 0; i < n; i++) box[i+1] = xs[i]->input_gate();
+	IntervalVector input_gate = f.eval_vector(box);
+	for (int j = 0; j < m; j++) image[m+j] = input_gate[j];
+      }
+  }
+
+  /* the images of the slices m_dirty_slices[first..end) by the batch evaluator : the boxes of their codomains and of their
+     input gates are gathered into arrays of bounds, the boxes not handled by the batch evaluator are evaluated by f */
+  void DerivativeCache::eval_slices_batch(const TFnc& f, int first, int end)
+  {
+    int n = m_x->size();
+    int m = m_v->size();
+    int nb = end - first;
+    int nb_boxes = 2*nb;   // the codomain boxes, then the input gate boxes
+    // one array of nb_boxes bounds per argument (t, then the variables), then per component of the image
+    vector<double> lb((n+1+m) * nb_boxes), ub((n+1+m) * nb_boxes);
+    vector<const double*> arg_lb(n+1), arg_ub(n+1);
+    vector<double*> img_lb(m), img_ub(m);
+    for (int j = 0; j <= n; j++)
+      {
+	arg_lb[j] = &lb[j*nb_boxes];
+	arg_ub[j] = &ub[j*nb_boxes];
+      }
+    for (int j = 0; j < m; j++)
+      {
+	img_lb[j] = &lb[(n+1+j)*nb_boxes];
+	img_ub[j] = &ub[(n+1+j)*nb_boxes];
+      }
+
+    for (int d = 0; d < nb; d++)
+      {
+	const Slice* const* xs = &m_x_slices[m_dirty_slices[first+d]*n];
+	const Interval& t = xs[0]->tdomain();
+	lb[d] = t.lb(); ub[d] = t.ub();
+	lb[nb+d] = t.lb(); ub[nb+d] = t.lb();
+	for (int i = 0; i < n; i++)
+	  {
+	    double* arg_l = &lb[(i+1)*nb_boxes];
+	    double* arg_u = &ub[(i+1)*nb_boxes];
+	    const Interval& codomain = xs[i]->codomain();
+	    Interval gate = xs[i]->input_gate();
+	    arg_l[d] = codomain.lb(); arg_u[d] = codomain.ub();
+	    arg_l[nb+d] = gate.lb(); arg_u[nb+d] = gate.ub();
+	  }
+      }
+    vector<char> valid(nb_boxes);
+    m_batch->eval(nb_boxes, arg_lb.data(), arg_ub.data(), img_lb.data(), img_ub.data(), valid.data());
+
+    IntervalVector box(n+1);
+    for (int d = 0; d < nb; d++)
+      {
+	Interval* image = &m_images[(first+d)*2*m];
+	for (int j = 0; j < m; j++)
+	  {
+	    if (valid[d]) image[j] = Interval(img_lb[j][d], img_ub[j][d]);
+	    if (valid[nb+d]) image[m+j] = Interval(img_lb[j][nb+d], img_ub[j][nb+d]);
+	  }
+	if (!valid[d] || !valid[nb+d])
+	  eval_slice(f, m_dirty_slices[first+d], box, image, !valid[d], !valid[nb+d]);
+      }
+  }
+
+  /* the slice k of v from its images, and the slice k of the kept tube from x ; the output gates of the last slices
+     are evaluated here. Done by the calling thread : the setters of a slice update data of its tube */
+  void DerivativeCache::store_slice(const TFnc& f, int k, const Interval* image)
+  {
+    int n = m_x->size();
+    int m = m_v->size();
+    bool last = (k == m_nb_slices-1);
+    const Slice* const* xs = &m_x_slices[k*n];
+    Slice* const* kept = &m_kept_slices[k*n];
+    Slice* const* vs = &m_v_slices[k*m];
+    for (int i = 0; i < n; i++)
+      {
+	kept[i]->set_envelope(xs[i]->codomain(), false);
+	kept[i]->set_input_gate(xs[i]->input_gate(), false);
+	if (last) kept[i]->set_output_gate(xs[i]->output_gate(), false);
+      }
+    for (int j = 0; j < m; j++)
+      {
+	vs[j]->set_envelope(image[j], false);
+	vs[j]->set_input_gate(image[m+j], false);
+      }
+
+    if (last)
+      {
+	IntervalVector box(n+1);
+	box[0] = Interval(xs[0]->tdomain().ub());
+	for (int i = 0; i < n; i++) box[i+1] = xs[i]->output_gate();
+	IntervalVector output_gate = f.eval_vector(box);
+	for (int j = 0; j < m; j++)
+	  vs[j]->set_output_gate(output_gate[j], false);
+      }
+  }
+
+  void DerivativeCache::run_ranges(int nb_items, ThreadPool* pool, const vector<TFnc*>* fncs, const TFnc& f,
+				   const function<void(const TFnc&, int, int)>& eval_range)
+  {
+    int nb_tasks = 1;
+    if (pool && fncs && pool->nb_threads() > 1)
+      nb_tasks = min(4 * pool->nb_threads(), nb_items / m_grain);   // several ranges per thread for the load balance
+    if (nb_tasks <= 1)
+      {
+	eval_range(f, 0, nb_items);
+	return;
+      }
+    pool->run(nb_tasks, [&](int task, int worker)
+      {
+	int first = (int)((long)task * nb_items / nb_tasks);
+	int end = (int)((long)(task+1) * nb_items / nb_tasks);
+	eval_range(*(*fncs)[worker], first, end);
+      });
+  }
+
+  /* the data of x built on demand by the evaluation of an intertemporal function (synthesis trees of the codomains
+     and of the primitives, when the syntheses are enabled) : built by queries over the whole tdomain, so that the threads
+     only read them */
+  static void build_syntheses(const TubeVector& x)
+  {
+    x(x.tdomain());
+    x.integral(x.tdomain());
+  }
+
+  /* the slices of v by eval_vector(k, x), in parallel (their codomains are computed by the threads, then written),
+     the gates of v being the intersections of the adjacent slices */
+  void DerivativeCache::eval_intertemporal(const TFnc& f, const TubeVector& x, ThreadPool* pool, const vector<TFnc*>& fncs)
+  {
+    int n = x.size();
+    int nb_slices = x.nb_slices();
+    m_v = new TubeVector(x, IntervalVector(n));
+    build_syntheses(x);
+    m_images.resize(nb_slices * n);
+    run_ranges(nb_slices, pool, &fncs, f, [&](const TFnc& fk, int first, int end)
+      {
+	for (int k = first; k < end; k++)
+	  {
+	    IntervalVector codomain = fk.eval_vector(k, x);
+	    for (int j = 0; j < n; j++)
+	      m_images[k*n+j] = codomain[j];
+	  }
+      });
+
+    for (int j = 0; j < n; j++)
+      {
+	int k = 0;
+	for (Slice* s = (*m_v)[j].first_slice(); s != NULL; s = s->next_slice(), k++)
+	  s->set_envelope(m_images[k*n+j], false);
+	// a gate is in the codomains of its two slices
+	Slice* s = (*m_v)[j].first_slice();
+	s->set_input_gate(s->codomain(), false);
+	for (; s != NULL; s = s->next_slice())
+	  s->set_output_gate(s->next_slice() ? s->codomain() & s->next_slice()->codomain() : s->codomain(), false);
+      }
+    m_nb_evaluated += nb_slices;
+  }
+
+  const TubeVector& DerivativeCache::eval(const TFnc& f, const TubeVector& x, ThreadPool* pool, const vector<TFnc*>* fncs)
+  {
+    assert(f.image_dim() == x.size());
+    if (f.is_intertemporal())
+      { // a slice depends on other slices : all the slices are evaluated
+	clear();
+	if (pool && fncs && pool->nb_threads() > 1)
+	  eval_intertemporal(f, x, pool, *fncs);
+	else
+	  {
+	    m_v = new TubeVector(f.eval_vector(x));
+	    m_nb_evaluated += x.nb_slices();
+	  }
+	return *m_v;
+      }
+
+    bool valid = m_x && m_f == &f && m_x->size() == x.size() && m_x->tdomain() == x.tdomain()
+      && align_slicing(x);
+    if (!valid)
+      { // all the slices are evaluated
+	clear();
+	m_f = &f;
+	m_x = new TubeVector(x);
+	m_v = new TubeVector(x, IntervalVector(x.size()));
+	m_dirty.assign(x.nb_slices(), 1);
+      }
+
+    int n = x.size();
+    int m = m_v->size();
+    int nb_slices = x.nb_slices();
+    m_nb_slices = nb_slices;
+    m_x_slices.resize(nb_slices * n); m_kept_slices.resize(nb_slices * n); m_v_slices.resize(nb_slices * m);
+    for (int i = 0; i < n; i++)
+      {
+	int k = 0;
+	Slice* kept = (*m_x)[i].first_slice();
+	for (const Slice* s = x[i].first_slice(); s != NULL; s = s->next_slice(), kept = kept->next_slice(), k++)
+	  {
+	    m_x_slices[k*n+i] = s;
+	    m_kept_slices[k*n+i] = kept;
+	  }
+      }
+    for (int j = 0; j < m; j++)
+      {
+	int k = 0;
+	for (Slice* s = (*m_v)[j].first_slice(); s != NULL; s = s->next_slice(), k++)
+	  m_v_slices[k*m+j] = s;
+      }
+
+    m_dirty_slices.clear();
+    for (int k = 0; k < nb_slices; k++)
+      {
+	bool dirty = m_dirty[k];
+	for (int i = k*n; i < (k+1)*n && !dirty; i++)
+	  dirty = m_x_slices[i]->codomain() != m_kept_slices[i]->codomain()
+	    || m_x_slices[i]->input_gate() != m_kept_slices[i]->input_gate()
+	    || m_x_slices[i]->output_gate() != m_kept_slices[i]->output_gate();
+	if (dirty) m_dirty_slices.push_back(k);
+      }
+    m_nb_evaluated += m_dirty_slices.size();
+    m_nb_reused += nb_slices - m_dirty_slices.size();
+
+    if (m_batch_f != &f)
+      { // the batch evaluator, for a TFunction using the operators it handles
+	delete m_batch;
+	m_batch = NULL;
+	m_batch_f = &f;
+	const TFunction* tf = dynamic_cast<const TFunction*>(&f);
+	if (tf)
+	  {
+	    m_batch = new TFunctionBatch(*tf);
+	    if (!m_batch->is_compiled() || m_batch->nb_arg() != n+1 || m_batch->image_dim() != m)
+	      {
+		delete m_batch;
+		m_batch = NULL;
+	      }
+	  }
+      }
+
+    m_images.resize(m_dirty_slices.size() * 2*m);
+    run_ranges(m_dirty_slices.size(), pool, fncs, f, [&](const TFnc& fk, int first, int end)
+      {
+	if (m_batch)
+	  eval_slices_batch(fk, first, end);
+	else
+	  {
+	    IntervalVector box(n+1);
+	    for (int d = first; d < end; d++)
+	      eval_slice(fk, m_dirty_slices[d], box, &m_images[d*2*m], true, true);
+	  }
+      });
+    for (size_t d = 0; d < m_dirty_slices.size(); d++)
+      store_slice(f, m_dirty_slices[d], &m_images[d*2*m]);
+    return *m_v;
+  }
+}
@@ -0,0 +1,88 @@
+/* ============================================================================
+ *  tubex-lib - DerivativeCache class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#ifndef __TUBEX_DERIVATIVECACHE_H__
+#define __TUBEX_DERIVATIVECACHE_H__
+
+#include <vector>
+#include "tubex_TubeVector.h"
+#include "tubex_TFnc.h"
+#include "tubex_ThreadPool.h"
+#include "tubex_TFunctionBatch.h"
+
+namespace tubex
+{
+  /* Derivative tube v = f(x) kept from one contraction to the next one : the fixed point contractions and var3b
+     evaluate f on tubes of which only a few slices have changed since the previous evaluation.
+     The tube x of the last evaluation is kept with v. At the next evaluation, the slicing of v follows the slicing of x
+     (v is sampled with x, the sampled slices being evaluated again), and f is only evaluated on the slices of x
+     whose codomain or gates differ from the kept ones.
+     A slice of v is the evaluation of f on the box (tdomain, codomains) of the slice, a gate the evaluation on (t, gates),
+     as in TFunction::eval_vector. An intertemporal function, or a coarsened slicing, is evaluated on the whole tube.
+     With a thread pool, the slices to evaluate are split into ranges whose images are computed in parallel, then written
+     into v by the calling thread : the worker w uses the function fncs[w] (a TFunction is not reentrant, see Solver::worker_fncs).
+     An intertemporal function has its slice k evaluated by eval_vector(k, x), the gates of v being the intersections of
+     the adjacent slices ; the data of x built on demand (syntheses, primitives) are built before the threads are started.
+     Its slices are all evaluated at each call : a slice depends on other slices of x.
+     The slices of a TFunction are evaluated by blocks by its batch evaluator (TFunctionBatch) when it handles its expression.
+     The function is identified by its address : the cache has to be reset when another function may have taken
+     this address (Solver::solve resets it at each solving). */
+  class DerivativeCache
+  {
+  public:
+
+      DerivativeCache();
+      ~DerivativeCache();
+
+      const TubeVector& eval(const TFnc& f, const TubeVector& x, ThreadPool* pool = NULL, const std::vector<TFnc*>* fncs = NULL);
+      void clear();
+      /* clear, and forget the function, its batch evaluator and the counters */
+      void reset();
+
+      /* number of slices evaluated and of slices reused */
+      long nb_evaluated() const;
+      long nb_reused() const;
+
+  protected:
+
+      bool align_slicing(const TubeVector& x);
+      void eval_slice(const TFnc& f, int k, ibex::IntervalVector& box, ibex::Interval* image, bool eval_codomain, bool eval_gate);
+      void eval_slices_batch(const TFnc& f, int first, int end);
+      void store_slice(const TFnc& f, int k, const ibex::Interval* image);
+      void eval_intertemporal(const TFnc& f, const TubeVector& x, ThreadPool* pool, const std::vector<TFnc*>& fncs);
+      // runs eval_range(f, first, end) on the ranges of the nb_items items, in parallel if pool is given
+      void run_ranges(int nb_items, ThreadPool* pool, const std::vector<TFnc*>* fncs, const TFnc& f,
+		      const std::function<void(const TFnc&, int, int)>& eval_range);
+
+      const TFnc* m_f = NULL;
+      TubeVector* m_x = NULL;  // x at the last evaluation
+      TubeVector* m_v = NULL;
+      int m_nb_slices = 0;
+      const TFnc* m_batch_f = NULL;
+      TFunctionBatch* m_batch = NULL;   // batch evaluator of m_batch_f, NULL if it cannot be compiled
+      std::vector<double> m_ubs;
+      std::vector<char> m_dirty;
+      std::vector<int> m_dirty_slices;
+      // slices of x, of the kept tube and of v, slice by slice (m_x_slices[k*n+i] : slice k of x[i])
+      std::vector<const Slice*> m_x_slices;
+      std::vector<Slice*> m_kept_slices;
+      std::vector<Slice*> m_v_slices;
+      // images computed by the threads (2*m per dirty slice : codomain, input gate ; m per slice if intertemporal)
+      std::vector<ibex::Interval> m_images;
+      long m_nb_evaluated = 0;
+      long m_nb_reused = 0;
+      /* Internal parameter : minimum number of slices evaluated by a thread */
+      int m_grain = 64;
+  };
+}
+
+#endif
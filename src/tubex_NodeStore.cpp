@@ -0,0 +1,238 @@
+/* ============================================================================
+ *  tubex-lib - NodeStore class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#include <cstdio>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include "tubex_NodeStore.h"
+#include "tubex_Exception.h"
+
+using namespace std;
+using namespace ibex;
+
+namespace tubex
+{
+  /* the stores of concurrent solvings (batch solving, solver copies, other processes) use different files :
+     a random number drawn once per process and a counter of the stores are appended to the file name */
+  NodeStore::NodeStore(long memory_budget, const string& spill_file)
+    : m_memory_budget(memory_budget)
+  {
+    static atomic<int> nb_stores(0);
+    static const unsigned int process_id = random_device()();
+    m_spill_file = spill_file + "." + to_string(process_id) + "." + to_string(nb_stores++);
+    m_file.open(m_spill_file.c_str(), ios::in | ios::out | ios::binary | ios::trunc);
+    if (!m_file.is_open())
+      throw Exception("NodeStore", "unable to open the spill file " + m_spill_file);
+  }
+
+  NodeStore::~NodeStore()
+  {
+    m_file.close();
+    remove(m_spill_file.c_str());
+  }
+
+  // a slice and its input gate per dimension
+  long NodeStore::tube_memory(const TubeVector& x)
+  {
+    return (long)x.size() * x.nb_slices() * (sizeof(Slice) + sizeof(Interval));
+  }
+
+  long NodeStore::node_memory(const SearchNode& node)
+  {
+    if (node.x) return tube_memory(*node.x);
+    if (node.code) return node.code->size() * sizeof(double);
+    return 0;
+  }
+
+  size_t NodeStore::record_size(int n, int nb_slices, bool with_codomains)
+  {
+    return 4 + nb_slices + n * (2*(nb_slices+1) + (with_codomains ? 2*nb_slices : 0));
+  }
+
+  /* record : n, nb_slices, with_codomains, tdomain lb, the upper bounds of the slices,
+     then for each dimension the lb and ub of the nb_slices+1 gates and of the nb_slices codomains (if with_codomains) */
+  void NodeStore::encode(const TubeVector& x, bool with_codomains, vector<double>& buf)
+  {
+    int n = x.size();
+    int nb_slices = x.nb_slices();
+    buf.clear();
+    buf.reserve(record_size(n, nb_slices, with_codomains));
+    buf.push_back(n);
+    buf.push_back(nb_slices);
+    buf.push_back(with_codomains);
+    buf.push_back(x.tdomain().lb());
+    for (const Slice* s = x[0].first_slice(); s != NULL; s = s->next_slice())
+      buf.push_back(s->tdomain().ub());
+    for (int i = 0; i < n; i++)
+      {
+	for (const Slice* s = x[i].first_slice(); s != NULL; s = s->next_slice())
+	  {
+	    Interval gate = s->input_gate();
+	    buf.push_back(gate.lb()); buf.push_back(gate.ub());
+	  }
+	Interval gate = x[i].last_slice()->output_gate();
+	buf.push_back(gate.lb()); buf.push_back(gate.ub());
+	if (with_codomains)
+	  for (const Slice* s = x[i].first_slice(); s != NULL; s = s->next_slice())
+	    {
+	      buf.push_back(s->codomain().lb()); buf.push_back(s->codomain().ub());
+	    }
+      }
+  }
+
+  TubeVector* NodeStore::decode(const vector<double>& buf, const TubeVector* x0)
+  {
+    int n = (int)buf[0];
+    int nb_slices = (int)buf[1];
+    bool with_codomains = buf[2] != 0.;
+    assert(with_codomains || x0);
+    const double* t_ub = &buf[4];
+    TubeVector* x = new TubeVector(Interval(buf[3], t_ub[nb_slices-1]), n);
+    const double* data = &buf[4 + nb_slices];
+    for (int i = 0; i < n; i++)
+      {
+	const double* gates = data;
+	const double* codomains = data + 2*(nb_slices+1);
+	Slice* s = (*x)[i].first_slice();
+	for (int k = 0; k < nb_slices; k++, s = s->next_slice())
+	  {
+	    if (k < nb_slices-1)
+	      (*x)[i].sample(t_ub[k], s);
+	    if (with_codomains)
+	      s->set_envelope(Interval(codomains[2*k], codomains[2*k+1]), false);
+	    else // the node is a subset of the initial tube
+	      s->set_envelope((*x0)[i](s->tdomain()), false);
+	    s->set_input_gate(Interval(gates[2*k], gates[2*k+1]), false);
+	    s->set_output_gate(Interval(gates[2*k+2], gates[2*k+3]), false);
+	  }
+	data += 2*(nb_slices+1) + (with_codomains ? 2*nb_slices : 0);
+      }
+    return x;
+  }
+
+  void NodeStore::write(SearchNode& node)
+  {
+    if (node.x)
+      encode(*node.x, true, m_buf);
+    const vector<double>& record = node.x ? m_buf : *node.code;
+    m_file.seekp(m_end);
+    m_file.write((const char*)record.data(), record.size() * sizeof(double));
+    if (!m_file)
+      throw Exception("NodeStore::write", "unable to write the spill file " + m_spill_file);
+    node.spill_offset = m_end;
+    m_end += record.size() * sizeof(double);
+    delete node.x;
+    node.x = NULL;
+    delete node.code;
+    node.code = NULL;
+    m_nb_spills++;
+  }
+
+  /* the nodes after the budget are spilled from the bottom of the stack upwards,
+     so that the top-most spilled node is the last one written */
+  void NodeStore::spill(list<SearchNode>& s)
+  {
+    long memory = 0;
+    list<SearchNode>::iterator it = s.begin();
+    for (; it != s.end(); ++it)
+      if (it->spill_offset < 0)
+	{
+	  memory += node_memory(*it);
+	  if (memory > m_memory_budget) break;
+	}
+    if (it == s.end()) return;
+
+    list<SearchNode>::iterator last = s.end();
+    do
+      {
+	--last;
+	if (last->spill_offset < 0) write(*last);
+      }
+    while (last != it);
+  }
+
+  void NodeStore::reload(SearchNode& node)
+  {
+    if (node.spill_offset < 0) return;
+    double header[3];
+    m_file.seekg(node.spill_offset);
+    m_file.read((char*)header, sizeof(header));
+    m_buf.resize(record_size((int)header[0], (int)header[1], header[2] != 0.));
+    copy(header, header+3, m_buf.begin());
+    m_file.read((char*)&m_buf[3], (m_buf.size()-3) * sizeof(double));
+    if (!m_file)
+      throw Exception("NodeStore::reload", "unable to read the spill file " + m_spill_file);
+
+    if (header[2] != 0.)
+      node.x = decode(m_buf);
+    else
+      node.code = new vector<double>(m_buf);   // rebuilt by expand
+    if (node.spill_offset + (long)(m_buf.size() * sizeof(double)) == m_end)
+      m_end = node.spill_offset;   // last record : its space is reused
+    node.spill_offset = -1;
+    m_nb_reloads++;
+  }
+
+  /* the nodes are compacted from the top of the stack down to the first compact or spilled one :
+     the nodes below it have already been compacted */
+  void NodeStore::compact(list<SearchNode>& s, int nb_kept)
+  {
+    list<SearchNode>::iterator it = s.begin();
+    for (int k = 0; k < nb_kept && it != s.end(); k++) ++it;
+    for (; it != s.end() && it->x; ++it)
+      {
+	it->code = new vector<double>();
+	encode(*it->x, false, *it->code);
+	delete it->x;
+	it->x = NULL;
+      }
+  }
+
+  bool NodeStore::expand(SearchNode& node, const TubeVector& x0)
+  {
+    if (!node.code) return false;
+    node.x = decode(*node.code, &x0);
+    delete node.code;
+    node.code = NULL;
+    return true;
+  }
+
+  void NodeStore::release(list<SearchNode>& s, SearchNode* node)
+  {
+    for (list<SearchNode>::iterator it = s.begin(); it != s.end(); ++it)
+      {
+	if (node && it->x == node->x) node->x = NULL;   // reused by a node of s
+	delete it->x;
+	delete it->code;
+      }
+    s.clear();
+    if (node)
+      {
+	delete node->x;
+	delete node->code;
+	node->x = NULL;
+	node->code = NULL;
+      }
+  }
+
+  int NodeStore::nb_spills() const
+  {
+    return m_nb_spills;
+  }
+
+  int NodeStore::nb_reloads() const
+  {
+    return m_nb_reloads;
+  }
+}
@@ -0,0 +1,107 @@
+/* ============================================================================
+ *  tubex-lib - NodeStore class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#ifndef __TUBEX_NODESTORE_H__
+#define __TUBEX_NODESTORE_H__
+
+#include <cstdint>
+#include <list>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <memory>
+#include "tubex_TubeVector.h"
+
+namespace tubex
+{
+  /* A bisection decision of the path of a search node : the gate at t was set to gate.
+     The decisions of a path are chained from the last one to the first one (shared by the nodes of a subtree). */
+  struct Decision
+  {
+    double t;
+    ibex::IntervalVector gate;
+    std::shared_ptr<const Decision> parent;
+  };
+
+  /* a pending node of the search tree : its depth, the time of the bisection that created it and its tube */
+  struct SearchNode
+  {
+    int level;
+    double t_bisect;
+    TubeVector* x;  // owned by the node, NULL when the tube is compact or spilled
+    std::vector<double>* code;  // compact encoding of the tube when x is NULL (see NodeStore::compact), NULL otherwise
+    std::shared_ptr<const Decision> decisions;  // recorded when the nogoods are used
+    uint64_t path;  // hash of the path from the root : seed of the random choices at this node
+    long spill_offset;  // position of the tube in the spill file when x is NULL (see NodeStore), -1 otherwise
+  };
+
+  /* Memory budget of the tubes of the pending nodes of the depth first search (Solver::set_node_memory_budget).
+     When the tubes in memory exceed the budget, the coldest ones (at the bottom of the stack) are encoded and
+     written to a spill file, and read back when their node is popped. As the spilled nodes are popped in the reverse
+     order of their writing, the file is used as a stack : it is written and read sequentially, and the space of a
+     tube read back at the end of the file is reused.
+     Encoding of a tube : the slicing once for all the dimensions, then for each dimension the gates (one per slice boundary)
+     and the codomains (optional), as doubles. The file is removed by the destructor.
+     The pending nodes can also be kept in memory in a compact encoding without the codomains (Solver::set_compact_nodes) :
+     the codomains are rebuilt from the initial tube when the node is popped, and recomputed by its contraction. */
+  class NodeStore
+  {
+  public:
+
+      /* memory_budget : in bytes, estimated from the number of slices of the tubes (see tube_memory) ;
+         spill_file : base name of the spill file, made unique to the store (see the constructor) */
+      NodeStore(long memory_budget, const std::string& spill_file);
+      ~NodeStore();
+
+      /* estimated memory of a tube */
+      static long tube_memory(const TubeVector& x);
+
+      /* estimated memory of the tube of a node, or of its compact encoding */
+      static long node_memory(const SearchNode& node);
+
+      /* the tubes of the last nodes of s are spilled while the tubes in memory exceed the budget */
+      void spill(std::list<SearchNode>& s);
+      /* the tube (or its compact encoding) of node is read back if it was spilled */
+      void reload(SearchNode& node);
+
+      int nb_spills() const;
+      int nb_reloads() const;
+
+      /* the nodes of s after the first nb_kept ones are encoded without their codomains */
+      static void compact(std::list<SearchNode>& s, int nb_kept);
+      /* the tube of a compact node is rebuilt, its codomains being the hulls of x0 on the slices ; 
+         returns true if the node was compact (its codomains have to be contracted again) */
+      static bool expand(SearchNode& node, const TubeVector& x0);
+      /* the tubes and encodings of the nodes of s are deleted, and those of node unless its tube is reused by a node of s
+         (search interrupted by an exception) */
+      static void release(std::list<SearchNode>& s, SearchNode* node = NULL);
+
+      static void encode(const TubeVector& x, bool with_codomains, std::vector<double>& buf);
+      /* x0 : initial tube giving the codomains of an encoding without codomains */
+      static TubeVector* decode(const std::vector<double>& buf, const TubeVector* x0 = NULL);
+      static size_t record_size(int n, int nb_slices, bool with_codomains);
+
+  protected:
+
+      void write(SearchNode& node);
+
+      long m_memory_budget;
+      std::string m_spill_file;
+      std::fstream m_file;
+      long m_end = 0;   // end of the used part of the file
+      int m_nb_spills = 0;
+      int m_nb_reloads = 0;
+      std::vector<double> m_buf;
+  };
+}
+
+#endif
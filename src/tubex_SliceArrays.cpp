@@ -0,0 +1,156 @@
+/* ============================================================================
+ *  tubex-lib - SliceArrays class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#include <cfloat>
+#include <cmath>
+#include <limits>
+#include "tubex_SliceArrays.h"
+#if defined(__AVX512F__) || defined(__AVX2__)
+  #include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace ibex;
+
+namespace tubex
+{
+  SliceArrays::SliceArrays()
+  {
+
+  }
+
+  void SliceArrays::load(const TubeVector& x)
+  {
+    m_n = x.size();
+    m_nb_slices = x.nb_slices();
+    int nb_gates = m_nb_slices + 1;
+    m_t_lb.resize(m_nb_slices); m_t_ub.resize(m_nb_slices);
+    m_codomain_lb.resize(m_n * m_nb_slices); m_codomain_ub.resize(m_n * m_nb_slices);
+    m_gate_lb.resize(m_n * nb_gates); m_gate_ub.resize(m_n * nb_gates);
+
+    int k = 0;
+    for (const Slice* s = x[0].first_slice(); s != NULL; s = s->next_slice(), k++)
+      {
+	m_t_lb[k] = s->tdomain().lb();
+	m_t_ub[k] = s->tdomain().ub();
+      }
+
+    // one linked list walked at a time
+    for (int i = 0; i < m_n; i++)
+      {
+	double* cod_lb = &m_codomain_lb[i * m_nb_slices];
+	double* cod_ub = &m_codomain_ub[i * m_nb_slices];
+	double* g_lb = &m_gate_lb[i * nb_gates];
+	double* g_ub = &m_gate_ub[i * nb_gates];
+	k = 0;
+	for (const Slice* s = x[i].first_slice(); s != NULL; s = s->next_slice(), k++)
+	  {
+	    const Interval& cod = s->codomain();
+	    cod_lb[k] = cod.lb(); cod_ub[k] = cod.ub();
+	    Interval gate = s->input_gate();
+	    g_lb[k] = gate.lb(); g_ub[k] = gate.ub();
+	  }
+	Interval gate = x[i].last_slice()->output_gate();
+	g_lb[m_nb_slices] = gate.lb(); g_ub[m_nb_slices] = gate.ub();
+      }
+  }
+
+  int SliceArrays::size() const
+  {
+    return m_n;
+  }
+
+  int SliceArrays::nb_slices() const
+  {
+    return m_nb_slices;
+  }
+
+  const double* SliceArrays::t_lb() const
+  {
+    return m_t_lb.data();
+  }
+
+  const double* SliceArrays::t_ub() const
+  {
+    return m_t_ub.data();
+  }
+
+  const double* SliceArrays::codomain_lb(int i) const
+  {
+    return &m_codomain_lb[i * m_nb_slices];
+  }
+
+  const double* SliceArrays::codomain_ub(int i) const
+  {
+    return &m_codomain_ub[i * m_nb_slices];
+  }
+
+  const double* SliceArrays::gate_lb(int i) const
+  {
+    return &m_gate_lb[i * (m_nb_slices + 1)];
+  }
+
+  const double* SliceArrays::gate_ub(int i) const
+  {
+    return &m_gate_ub[i * (m_nb_slices + 1)];
+  }
+
+  // ------------------------------------------------------ KERNELS ------------------------------------------------------
+
+  /* |mid(g[k+1]) - mid(g[k])| for k in [0,n), max-ed into step[k] ; a non finite value (unbounded gate) counts as infinite */
+  static void max_gate_steps(const double* g_lb, const double* g_ub, double* step, int n)
+  {
+    const double inf = numeric_limits<double>::infinity();
+    int k = 0;
+#if defined(__AVX512F__)
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d vmax = _mm512_set1_pd(DBL_MAX);
+    const __m512d vinf = _mm512_set1_pd(inf);
+    for (; k + 8 <= n; k += 8)
+      {
+	__m512d mid_in = _mm512_mul_pd(half, _mm512_add_pd(_mm512_loadu_pd(g_lb + k), _mm512_loadu_pd(g_ub + k)));
+	__m512d mid_out = _mm512_mul_pd(half, _mm512_add_pd(_mm512_loadu_pd(g_lb + k + 1), _mm512_loadu_pd(g_ub + k + 1)));
+	__m512d d = _mm512_abs_pd(_mm512_sub_pd(mid_out, mid_in));
+	__mmask8 finite = _mm512_cmp_pd_mask(d, vmax, _CMP_LE_OQ);   // false for NaN
+	d = _mm512_mask_blend_pd(finite, vinf, d);
+	_mm512_storeu_pd(step + k, _mm512_max_pd(_mm512_loadu_pd(step + k), d));
+      }
+#elif defined(__AVX2__)
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d sign = _mm256_set1_pd(-0.);
+    const __m256d vmax = _mm256_set1_pd(DBL_MAX);
+    const __m256d vinf = _mm256_set1_pd(inf);
+    for (; k + 4 <= n; k += 4)
+      {
+	__m256d mid_in = _mm256_mul_pd(half, _mm256_add_pd(_mm256_loadu_pd(g_lb + k), _mm256_loadu_pd(g_ub + k)));
+	__m256d mid_out = _mm256_mul_pd(half, _mm256_add_pd(_mm256_loadu_pd(g_lb + k + 1), _mm256_loadu_pd(g_ub + k + 1)));
+	__m256d d = _mm256_andnot_pd(sign, _mm256_sub_pd(mid_out, mid_in));
+	__m256d finite = _mm256_cmp_pd(d, vmax, _CMP_LE_OQ);          // false for NaN
+	d = _mm256_blendv_pd(vinf, d, finite);
+	_mm256_storeu_pd(step + k, _mm256_max_pd(_mm256_loadu_pd(step + k), d));
+      }
+#endif
+    for (; k < n; k++)
+      {
+	double d = fabs(0.5*(g_lb[k+1]+g_ub[k+1]) - 0.5*(g_lb[k]+g_ub[k]));
+	if (!(d <= DBL_MAX)) d = inf;
+	if (d > step[k]) step[k] = d;
+      }
+  }
+
+  void SliceArrays::steps(vector<double>& step) const
+  {
+    step.assign(m_nb_slices, 0.);
+    for (int i = 0; i < m_n; i++)
+      max_gate_steps(gate_lb(i), gate_ub(i), step.data(), m_nb_slices);
+  }
+}
@@ -0,0 +1,64 @@
+/* ============================================================================
+ *  tubex-lib - SliceArrays class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#ifndef __TUBEX_SLICEARRAYS_H__
+#define __TUBEX_SLICEARRAYS_H__
+
+#include <vector>
+#include "tubex_TubeVector.h"
+
+namespace tubex
+{
+  /* Structure-of-arrays copy of the slices of a tube vector, used by the solver for its scans
+     over all the slices (refining thresholds and payoffs, coarsening, var3b times) : the bounds are stored
+     in contiguous arrays, one array per bound and per dimension, instead of walking the linked lists of slices.
+     For the dimension i and the slice k (0 <= k < nb_slices) :
+       tdomain  : [t_lb()[k], t_ub()[k]]
+       codomain : [codomain_lb(i)[k], codomain_ub(i)[k]]
+       input gate : [gate_lb(i)[k], gate_ub(i)[k]], output gate : index k+1 (nb_slices+1 gates).
+     The arrays are a snapshot : they have to be loaded again after any modification of the tube. */
+  class SliceArrays
+  {
+  public:
+
+      SliceArrays();
+
+      /* copies the bounds of x (the buffers are reused from one load to another) */
+      void load(const TubeVector& x);
+
+      int size() const;
+      int nb_slices() const;
+
+      const double* t_lb() const;
+      const double* t_ub() const;
+      const double* codomain_lb(int i) const;
+      const double* codomain_ub(int i) const;
+      const double* gate_lb(int i) const;
+      const double* gate_ub(int i) const;
+
+      /* Vectorized scans (AVX-512 or AVX2 when the compiler targets them, scalar loops otherwise) */
+
+      /* step[k] : max over the dimensions of |mid(output gate) - mid(input gate)| of the slice k,
+         infinite if a gate is unbounded */
+      void steps(std::vector<double>& step) const;
+
+  protected:
+
+      int m_n = 0;
+      int m_nb_slices = 0;
+      std::vector<double> m_t_lb, m_t_ub;
+      std::vector<double> m_codomain_lb, m_codomain_ub;  // m_nb_slices values per dimension
+      std::vector<double> m_gate_lb, m_gate_ub;          // m_nb_slices+1 values per dimension
+  };
+}
+
+#endif
@@ -12,8 +12,10 @@
 
 
 #include <time.h>
+#include <chrono>
 #include "tubex_Solver.h"
 #include "tubex_Exception.h"
+#include "ibex_LargestFirst.h"
 #define GRAPHICS 0
 
 
@@ -34,8 +36,59 @@ namespace tubex
     #endif
   }
 
+  /* the parameters are copied, the search state (counters, nogoods, buffers, caches, threads, figure) starts empty */
+  Solver::Solver(const Solver& solver) :
+    solving_time(0.),
+    m_max_thickness(solver.m_max_thickness),
+    m_refining_fxpt_ratio(solver.m_refining_fxpt_ratio),
+    m_propa_fxpt_ratio(solver.m_propa_fxpt_ratio),
+    m_var3b_fxpt_ratio(solver.m_var3b_fxpt_ratio),
+    m_var3b_propa_fxpt_ratio(solver.m_var3b_propa_fxpt_ratio),
+    m_var3b_bisection_minrate(solver.m_var3b_bisection_minrate),
+    m_var3b_bisection_maxrate(solver.m_var3b_bisection_maxrate),
+    m_var3b_bisection_ratefactor(solver.m_var3b_bisection_ratefactor),
+    m_var3b_mode(solver.m_var3b_mode),
+    m_var3b_timepoints(solver.m_var3b_timepoints),
+    m_var3b_skip_threshold(solver.m_var3b_skip_threshold),
+    m_var3b_dichotomy_trials(solver.m_var3b_dichotomy_trials),
+    m_var3b_timept(solver.m_var3b_timept),
+    m_bisection_timept(solver.m_bisection_timept),
+    m_bisection_arity(solver.m_bisection_arity),
+    m_bisection_ratio(solver.m_bisection_ratio),
+    m_bisection_min_ratio(solver.m_bisection_min_ratio),
+    m_bisection_trial_contraction(solver.m_bisection_trial_contraction),
+    m_nogood_capacity(solver.m_nogood_capacity),
+    m_contraction_cache(solver.m_contraction_cache),
+    m_seed(solver.m_seed),
+    m_search_wave_width(solver.m_search_wave_width),
+    m_compact_nodes(solver.m_compact_nodes),
+    m_node_memory_budget(solver.m_node_memory_budget),
+    m_spill_file(solver.m_spill_file),
+    m_trace(solver.m_trace),
+    m_max_slices(solver.m_max_slices),
+    m_coarsening_ratio(solver.m_coarsening_ratio),
+    m_slice_budget_depth_factor(solver.m_slice_budget_depth_factor),
+    m_max_open_slices(solver.m_max_open_slices),
+    m_slice_budget_thin_ratio(solver.m_slice_budget_thin_ratio),
+    m_refining_mode(solver.m_refining_mode),
+    m_refining_quantile(solver.m_refining_quantile),
+    m_refining_payoff_share(solver.m_refining_payoff_share),
+    m_contraction_mode(solver.m_contraction_mode),
+    m_stopping_mode(solver.m_stopping_mode),
+    m_var3b_external_contraction(solver.m_var3b_external_contraction),
+    m_nb_threads(solver.m_nb_threads),
+    m_time_segments(solver.m_time_segments),
+    m_time_segments_gate_ratio(solver.m_time_segments_gate_ratio)
+  {
+
+  }
+
   Solver::~Solver()
   {
+    release_worker_fncs();
+    delete m_pool;
+    delete m_node_store;
+    delete m_derivative_cache;
     #if GRAPHICS
       delete m_fig;
       vibes::endDrawing();
@@ -79,15 +132,109 @@ namespace tubex
     m_trace = trace;
   }
 
+  void Solver::set_nb_threads(int nb_threads)
+  {
+    m_nb_threads = nb_threads;
+    delete m_pool; m_pool = NULL;
+  }
+
+  void Solver::set_time_segments(int time_segments)
+  {
+    m_time_segments = time_segments;
+  }
+
   void Solver::set_max_slices(int max_slices)
   {
     m_max_slices=max_slices;
   }
   
+  void Solver::set_slice_budget_depth_factor(double depth_factor)
+  {
+    assert(depth_factor > 0. && depth_factor <= 1.);
+    m_slice_budget_depth_factor=depth_factor;
+  }
+
+  void Solver::set_max_open_slices(long max_open_slices)
+  {
+    m_max_open_slices=max_open_slices;
+  }
+
+  void Solver::set_bisection_arity(int arity)
+  {
+    assert(arity >= 2);
+    m_bisection_arity=arity;
+  }
+
+  void Solver::set_bisection_ratio(float ratio)
+  {
+    assert(ratio > 0. && ratio < 1.);
+    m_bisection_ratio=ratio;
+  }
+
+  void Solver::set_bisection_trial_contraction(bool trial_contraction)
+  {
+    m_bisection_trial_contraction=trial_contraction;
+  }
+
+  void Solver::set_nogood_capacity(int capacity)
+  {
+    m_nogood_capacity=capacity;
+  }
+
+  void Solver::set_contraction_cache(ContractionCache* cache)
+  {
+    m_contraction_cache=cache;
+  }
+
+  void Solver::set_seed(unsigned int seed)
+  {
+    m_seed=seed;
+  }
+
+  void Solver::set_deterministic_search(int wave_width)
+  {
+    assert(wave_width >= 0);
+    m_search_wave_width=wave_width;
+  }
+
+  void Solver::set_compact_nodes(bool compact_nodes)
+  {
+    m_compact_nodes=compact_nodes;
+  }
+
+  void Solver::set_node_memory_budget(long memory_budget, const string& spill_file)
+  {
+    assert(memory_budget >= 0);
+    m_node_memory_budget=memory_budget;
+    m_spill_file=spill_file;
+  }
+
+  void Solver::set_var3b_timepoints(int var3b_timepoints)
+  {
+    assert(var3b_timepoints >= 1);
+    m_var3b_timepoints=var3b_timepoints;
+  }
+
+  void Solver::set_var3b_mode(int var3b_mode)
+  {
+    m_var3b_mode=var3b_mode;
+  }
+
+  void Solver::set_coarsening_ratio(double coarsening_ratio)
+  {
+    m_coarsening_ratio=coarsening_ratio;
+  }
+
   void Solver::set_refining_mode(int refining_mode)
   {
     m_refining_mode=refining_mode;
   }
+
+  void Solver::set_refining_quantile(double refining_quantile)
+  {
+    assert(refining_quantile >= 0. && refining_quantile <= 1.);
+    m_refining_quantile=refining_quantile;
+  }
     
   void Solver::set_contraction_mode(int contraction_mode)
   {
@@ -105,13 +252,14 @@ namespace tubex
   }
 
 
-  double Solver::one_finite_gate(const TubeVector &x){
+  // t : a time of a finite gate (the first or last gate if finite in all dimensions) ; false if there is no finite bisectable gate
+  bool Solver::one_finite_gate(const TubeVector &x, double& t){
     bool finite=true;
     for (int i=0; i< x.size() ; i++)
       if (x[i].first_slice()->input_gate().diam() >= DBL_MAX)
 	{finite=false;break;}
     if (finite==true)
-      return x[0].first_slice()->tdomain().lb();
+      {t= x[0].first_slice()->tdomain().lb(); return true;}
     else{
       finite=true; 
       for (int i=0; i< x.size() ; i++)
@@ -119,23 +267,87 @@ namespace tubex
 	{finite=false;break;}
     }
     if (finite==true)
-      return x[0].last_slice()->tdomain().ub();
+      {t= x[0].last_slice()->tdomain().ub(); return true;}
     else{
       for (int i=0 ;i< x.size(); i++){
 	for ( const Slice*s= x[i].first_slice(); s!=NULL; s=s->next_slice())
 	  if (s->input_gate().diam()<DBL_MAX && s->input_gate().diam()>0  )
-	    {return s->tdomain().lb();}
+	    {t= s->tdomain().lb(); return true;}
       }
     }
-    throw tubex::Exception (" solver " , "solver unable to bisect ");
+    return false;
   }
 	       
     
 
-  bool Solver::refining(TubeVector& x)
+  const vector<char>& Solver::newly_split_slices() const
+  {
+    return m_newly_split;
+  }
+
+  /* m_slices is loaded with x, unless it already holds x unchanged since its last load : the scans of a search step
+     (refining thresholds, coarsening, var3b times) share one copy of the slices.
+     Every modification of the tube of the node has to reset m_slices_tube. */
+  void Solver::load_slices(const TubeVector& x)
+  {
+    if (m_slices_tube == &x) return;
+    m_slices.load(x);
+    m_slices_tube = &x;
+  }
+
+  /* slices allowed for the tube x of a node at depth level : the budget decreases with the depth, unless the tube
+     is already thin (close to a solution), and the open nodes share max_open_slices (the current node may be bisected :
+     its two children count twice its slices) */
+  int Solver::slice_budget(const TubeVector &x, int level)
+  {
+    double budget = m_max_slices;
+    bool thin = true;
+    Vector max_diam = x.max_diam();
+    for (int i=0; i<x.size() && thin; i++)
+      if (!(max_diam[i] <= m_slice_budget_thin_ratio * m_max_thickness[i])) thin=false;
+    if (!thin)
+      budget *= pow(m_slice_budget_depth_factor, level);
+    if (m_max_open_slices > 0)
+      budget = min(budget, (m_max_open_slices - m_open_slices) / 2.);
+    return max((int) budget, x.nb_slices());  // never less than the current slicing : no refining
+  }
+
+  bool Solver::refining(TubeVector& x, int level)
+  {
+    m_slices_tube = NULL;   // x is sliced before the scans of the refining
+    m_slice_budget = slice_budget(x, level);
+    if (m_trace && m_slice_budget < m_max_slices) cout << " slice budget " << m_slice_budget << endl;
+    m_slicing_ubs.clear();
+    for (const Slice* s= x[0].first_slice(); s!=NULL; s=s->next_slice())
+      m_slicing_ubs.push_back(s->tdomain().ub());
+    bool refined = refining_by_mode(x);
+    m_slices_tube = NULL;
+    compute_newly_split(x);
+    return refined;
+  }
+
+  // the new slicing refines the old one (m_slicing_ubs) : a slice is new if it does not coincide with an old slice
+  void Solver::compute_newly_split(const TubeVector& x)
+  {
+    m_newly_split.assign(x.nb_slices(), 0);
+    size_t j=0;
+    double old_lb = x.tdomain().lb();
+    int k=0;
+    for (const Slice* s= x[0].first_slice(); s!=NULL; s=s->next_slice(), k++){
+      const Interval& dom = s->tdomain();
+      if (j >= m_slicing_ubs.size() || dom.lb() != old_lb || dom.ub() != m_slicing_ubs[j])
+	m_newly_split[k] = 1;
+      if (j < m_slicing_ubs.size() && dom.ub() == m_slicing_ubs[j]){
+	old_lb = m_slicing_ubs[j];
+	j++;
+      }
+    }
+  }
+
+  bool Solver::refining_by_mode(TubeVector& x)
   {
     int nb_slices=x[0].nb_slices();
-    if (nb_slices >= m_max_slices)  // no refining if max_slices is already reached
+    if (nb_slices >= m_slice_budget)  // no refining if the slice budget is already reached
       return false;
 
     //   cout << " volume before refining " << x.volume() << endl;
@@ -155,65 +367,189 @@ namespace tubex
 	refining_all_slices(x);
 	return true;
       }
-    else if (m_refining_mode== 2 || m_refining_mode== 3){ // first, 10% of the slices (the widest) are refined
+    else if (m_refining_mode== 2 || m_refining_mode== 3 || m_refining_mode== 4){ // first, 10% of the slices (the widest) are refined
       int nb_refining = nb_slices/10 +1;
       for (int k=0; k< nb_refining; k++){
 
 	double t_refining= x[0].wider_slice()->tdomain().mid();    
 	x.sample(t_refining);
-	if (k+nb_slices+1 >= m_max_slices) return true;
+	if (k+nb_slices+1 >= m_slice_budget) return true;
       }
       refining_with_threshold(x);
       return true;
     }
+    else if (m_refining_mode== 5){
+      refining_by_payoff(x);
+      return true;
+    }
     else return false;
   }
 
+  /* bulk refining : the slices k with split[k] set are split at their midpoint, in one pass over the slices 
+     with all the dimensions in lockstep (the components keep the same slicing) ; 
+     at most max_new_slices slices are added, the number of new slices is returned */
+  int Solver::refine_slices(TubeVector& x, const vector<char>& split, int max_new_slices)
+  {
+    int n = x.size();
+    m_lockstep.resize(n);
+    for (int i=0; i<n; i++)
+      m_lockstep[i] = x[i].first_slice();
+
+    int new_slices=0;
+    for (size_t k=0; m_lockstep[0]!=NULL && new_slices < max_new_slices; k++){
+      if (k < split.size() && split[k]){
+	double wid = m_lockstep[0]->tdomain().diam();
+	double t = m_lockstep[0]->tdomain().mid();
+	for (int i=0; i<n; i++)
+	  x[i].sample(t, m_lockstep[i]);
+	if (m_lockstep[0]->tdomain().diam() < wid){ // refining is actually done : skip the second half
+	  new_slices++;
+	  for (int i=0; i<n; i++)
+	    m_lockstep[i] = m_lockstep[i]->next_slice();
+	}
+      }
+      for (int i=0; i<n; i++)
+	m_lockstep[i] = m_lockstep[i]->next_slice();
+    }
+    return new_slices;
+  }
+
   void Solver::refining_all_slices(TubeVector & x) {
     int nb_slices=x[0].nb_slices();
-    for (int i=0; i<x.size();i++)
-	  {
-	    int k=0;
-	    for ( Slice*s= x[i].first_slice(); s!=NULL; s=s->next_slice()){
-	      if (k+nb_slices >= m_max_slices) break;
-	      double wid=s->tdomain().diam();
-	      x[i].sample(s->tdomain().mid(),s);
-	      if (s->tdomain().diam() < wid){ // refining is actually done
-		k++;
-		s=s->next_slice();
-	      }
-	    }
-	  }
+    m_split.assign(nb_slices, 1);
+    refine_slices(x, m_split, m_slice_budget - nb_slices);
   }
 
 
-  // the refining is focused on slices  with a larger than average (or median) max difference (in all dimensions)  between input and output gates
+  /* estimated gain of splitting each slice : a codomain wider than the hull of its input and output gates can be contracted
+     by the new inner gate, the excess is summed over the dimensions in units of thickness and weighted by the slice length */
+  void Solver::slice_payoffs(const TubeVector & x, vector<double>& payoff){
+    load_slices(x);
+    int nb_slices = m_slices.nb_slices();
+    const double* t_lb = m_slices.t_lb();
+    const double* t_ub = m_slices.t_ub();
+    payoff.assign(nb_slices, 0.);
+    for (int i=0; i<x.size(); i++){
+      const double* cod_lb = m_slices.codomain_lb(i);
+      const double* cod_ub = m_slices.codomain_ub(i);
+      const double* g_lb = m_slices.gate_lb(i);
+      const double* g_ub = m_slices.gate_ub(i);
+      for (int k=0; k<nb_slices; k++){
+	double hull_diam = max(g_ub[k], g_ub[k+1]) - min(g_lb[k], g_lb[k+1]);
+	double excess = (cod_ub[k] - cod_lb[k]) - hull_diam;
+	if (excess > 0.)
+	  payoff[k] += excess / m_max_thickness[i];
+      }
+    }
+    for (int k=0; k<nb_slices; k++){
+      payoff[k] *= t_ub[k] - t_lb[k];
+      if (!(payoff[k] <= DBL_MAX)) payoff[k] = DBL_MAX;   // unbounded slices first
+    }
+  }
+
+  // the slices are split by decreasing estimated gain, until m_refining_payoff_share of the total gain or the slices budget is reached
+  void Solver::refining_by_payoff (TubeVector & x){
+    int nb_slices = x[0].nb_slices();
+    vector<double>& payoff = m_slice_step;
+    slice_payoffs(x, payoff);
+
+    double total = 0.;
+    for (int k=0; k<nb_slices; k++)
+      total += payoff[k];
+    int budget = min(nb_slices, m_slice_budget - nb_slices);
+    m_split.assign(nb_slices, 0);
+    if (total <= 0. || budget <= 0) return;
+
+    m_slice_order.resize(nb_slices);
+    for (int k=0; k<nb_slices; k++)
+      m_slice_order[k] = k;
+    partial_sort(m_slice_order.begin(), m_slice_order.begin()+budget, m_slice_order.end(),
+		 [&payoff](int k1, int k2) { return payoff[k1] > payoff[k2]; });
+
+    double covered = 0.;
+    for (int j=0; j<budget && covered < m_refining_payoff_share * total && payoff[m_slice_order[j]] > 0.; j++){
+      m_split[m_slice_order[j]] = 1;
+      covered += payoff[m_slice_order[j]];
+    }
+    refine_slices(x, m_split, budget);
+    if (m_trace) cout << " estimated gain " << total << " covered " << covered << endl;
+  }
+
+
+  /* merges the adjacent slices whose union stays within the max thickness and has a volume less than 
+     (1+m_coarsening_ratio) times the sum of their volumes, in every dimension ;
+     the gate at t_kept (the last bisection time) is kept. Returns the number of removed gates. */
+  int Solver::coarsening(TubeVector & x, double t_kept){
+    if (m_coarsening_ratio < 0. || x.nb_slices() < 2) return 0;
+    int n = x.size();
+    load_slices(x);
+    int nb_slices = m_slices.nb_slices();
+    const double* t_lb = m_slices.t_lb();
+    const double* t_ub = m_slices.t_ub();
+
+    // current block of merged slices [b, k-1] : hull and sum of the volumes of its codomains in each dimension
+    m_block_hull.resize(n);
+    m_block_volume.resize(n);
+    int b=0;
+    for (int i=0; i<n; i++){
+      m_block_hull[i] = Interval(m_slices.codomain_lb(i)[0], m_slices.codomain_ub(i)[0]);
+      m_block_volume[i] = (t_ub[0]-t_lb[0]) * m_block_hull[i].diam();
+    }
+    m_removed_gates.clear();
+    for (int k=1; k<nb_slices; k++){
+      bool merge = (t_lb[k] != t_kept);
+      for (int i=0; i<n && merge; i++){
+	Interval cod (m_slices.codomain_lb(i)[k], m_slices.codomain_ub(i)[k]);
+	Interval hull = m_block_hull[i] | cod;
+	double volume = m_block_volume[i] + (t_ub[k]-t_lb[k]) * cod.diam();
+	double merged_volume = (t_ub[k]-t_lb[b]) * hull.diam();
+	if (!(hull.diam() <= m_max_thickness[i]) || !(merged_volume - volume <= m_coarsening_ratio * volume))
+	  merge=false;
+      }
+      if (merge){
+	m_removed_gates.push_back(t_lb[k]);
+	for (int i=0; i<n; i++){
+	  Interval cod (m_slices.codomain_lb(i)[k], m_slices.codomain_ub(i)[k]);
+	  m_block_hull[i] |= cod;
+	  m_block_volume[i] += (t_ub[k]-t_lb[k]) * cod.diam();
+	}
+      }
+      else{ // new block
+	b=k;
+	for (int i=0; i<n; i++){
+	  m_block_hull[i] = Interval(m_slices.codomain_lb(i)[k], m_slices.codomain_ub(i)[k]);
+	  m_block_volume[i] = (t_ub[k]-t_lb[k]) * m_block_hull[i].diam();
+	}
+      }
+    }
+
+    for (size_t j=0; j<m_removed_gates.size(); j++)
+      x.remove_gate(m_removed_gates[j]);
+    if (!m_removed_gates.empty()){
+      m_slices_tube = NULL;
+      m_newly_split.clear();  // the slicing has changed : no more valid
+      if (m_trace) cout << " coarsening : " << m_removed_gates.size() << " slices merged, nb_slices " << x.nb_slices() << endl;
+    }
+    return m_removed_gates.size();
+  }
+
+  // the refining is focused on slices  with a larger than average (or median, or quantile) max difference (in all dimensions)  between input and output gates
   void Solver::refining_with_threshold (TubeVector & x){
     int nb_slices_before = x[0].nb_slices();
-    vector<double>  slice_step;
+    vector<double>& slice_step = m_slice_step;
 
     double step_threshold=0;
     if (m_refining_mode==2) step_threshold= average_refining_threshold(x, slice_step);
     else if (m_refining_mode==3) step_threshold= median_refining_threshold(x, slice_step);
+    else if (m_refining_mode==4) step_threshold= quantile_refining_threshold(x, slice_step, m_refining_quantile);
     double min_diam=(x.tdomain().diam() / (100 * nb_slices_before));      
-    for (int i=0; i<x.size();i++)
-      {
-	int k=0; 
-	int new_slices=0; 
-
-	for ( Slice*s= x[i].first_slice(); s!=NULL; s=s->next_slice()){
-	  if (new_slices +nb_slices_before >= m_max_slices) break;
-
-	  if (slice_step[k] >= step_threshold  && (s->tdomain().diam() > min_diam))
-	    {
-	      x[i].sample(s->tdomain().mid(),s);
-	      //     cout << " sample " << s->tdomain().mid() << endl;
-	      s=s->next_slice();
-	      new_slices++;
-	    }
-	  k++;
-	}
-      }
+    // m_slices has been loaded with x by the threshold computation
+    const double* t_lb = m_slices.t_lb();
+    const double* t_ub = m_slices.t_ub();
+    m_split.resize(nb_slices_before);
+    for (int k=0; k<nb_slices_before; k++)
+      m_split[k] = (slice_step[k] >= step_threshold  && (t_ub[k] - t_lb[k] > min_diam));
+    refine_slices(x, m_split, m_slice_budget - nb_slices_before);
   }
 
   
@@ -221,35 +557,27 @@ namespace tubex
 
 
   double Solver::median_refining_threshold (const TubeVector &x, vector<double> & slice_step){
+	return quantile_refining_threshold(x, slice_step, 0.5);
+  }
 
-	double step_threshold;
-	vector<double> stepmed;
-	const Slice* s[x.size()];
-	for(int k=0; k< x.size(); k++)
-	  s[k]=x[k].first_slice();
-
-	for (const Slice*slice=s[0]; slice!=NULL; slice=slice->next_slice()){
-	  //          cout << " t_refining " << slice->tdomain().mid() << endl;
-	  double step_max= fabs(slice->output_gate().mid() - slice->input_gate().mid());
+  // linear time selection (nth_element) of the quantile of the finite steps, in a buffer reused from one call to another
+  double Solver::quantile_refining_threshold (const TubeVector &x, vector<double> & slice_step, double quantile){
 
-	  for (int k=1; k< x.size(); k++){
+	load_slices(x);
+	m_slices.steps(slice_step);  // max (in all dimensions) difference between the midpoints of the output and input gates
 
-	    step_max=std::max(step_max,fabs(s[k]->output_gate().mid() - s[k]->input_gate().mid()));
+	m_finite_steps.clear();
+	for (size_t k=0; k< slice_step.size(); k++)
+	  if (slice_step[k] < DBL_MAX)  // to not take into account infinite gates in quantile computation
+	    m_finite_steps.push_back(slice_step[k]);
+	if (m_finite_steps.empty())  // all gates infinite : no threshold
+	  return 0.;
 
-	    s[k]=s[k]->next_slice();
-	  }
-	  //   cout << " step max " << step_max << endl;
-	  slice_step.push_back(step_max);
-	  if (step_max < DBL_MAX)  // to not take into account infinite gates in average computation
-	    {
-	      stepmed.push_back(step_max); // storage for computing the median value
-	    }
-	}
-	
-	sort(stepmed.begin(),stepmed.end());
-	step_threshold =stepmed[stepmed.size()/2];
-	//	cout << " threshold " << step_threshold << endl;
-	return step_threshold;
+	size_t rank = (size_t)(quantile * m_finite_steps.size());
+	if (rank >= m_finite_steps.size()) rank = m_finite_steps.size()-1;
+	nth_element(m_finite_steps.begin(), m_finite_steps.begin()+rank, m_finite_steps.end());
+	//	cout << " threshold " << m_finite_steps[rank] << endl;
+	return m_finite_steps[rank];
   }
 
  
@@ -258,129 +586,360 @@ namespace tubex
     
   {
         int nbsteps=0;
-	double step_threshold;
+	double step_threshold=0.;
+	load_slices(x);
+	m_slices.steps(slice_step);  // max (in all dimensions) difference between the midpoints of the output and input gates
 
-	const Slice* s[x.size()];
-	for(int k=0; k< x.size(); k++)
-	  s[k]=x[k].first_slice();
-
-	for (const Slice*slice=s[0]; slice!=NULL; slice=slice->next_slice()){
+	for (size_t k=0; k< slice_step.size(); k++)
+	  if (slice_step[k] < DBL_MAX)  // to not take into account infinite gates in average computation
+	    {
+		nbsteps++;
+		step_threshold=(step_threshold*(nbsteps-1)+slice_step[k])/nbsteps;
+	    }
+	return step_threshold;
+  }
 
-	  double step_max= fabs(slice->output_gate().mid() - slice->input_gate().mid());
+  // the tests of ibex::LargestFirst (precision 0) : a gate can be bisected if one of its components can
+  bool Solver::is_bisectable(const Interval& gate) {
+    return !gate.is_empty() && gate.is_bisectable();
+  }
 
-	  for (int k=1; k< x.size(); k++){
+  bool Solver::is_bisectable(const IntervalVector& gate) {
+    for (int i=0; i<gate.size(); i++)
+      if (is_bisectable(gate[i])) return true;
+    return false;
+  }
 
-	    step_max=std::max(step_max,fabs(s[k]->output_gate().mid() - s[k]->input_gate().mid()));
+  //----------------------------------------- NOGOODS ----------------------------------------------
+
+  // the path of a refuted node : no solution in the initial tube restricted by these decisions
+  void Solver::add_nogood(const shared_ptr<const Decision>& decisions) {
+    if (m_nogood_capacity <= 0 || !decisions) return;
+    m_nogoods.push_back(decisions);
+    for (const Decision* d = decisions.get(); d != NULL; d = d->parent.get())
+      m_nogood_times[d->t]++;
+    if ((int)m_nogoods.size() > m_nogood_capacity){
+      for (const Decision* d = m_nogoods.front().get(); d != NULL; d = d->parent.get()){
+	map<double,int>::iterator it = m_nogood_times.find(d->t);
+	if (--(it->second) == 0) m_nogood_times.erase(it);
+      }
+      m_nogoods.pop_front();
+    }
+  }
 
-	    s[k]=s[k]->next_slice();
-	  }
+  /* the gates of x at the decision times of the nogoods (m_nogood_times, in increasing order) into m_nogood_gates :
+     one pass over the slices of each dimension instead of one lookup x(t) per decision */
+  void Solver::nogood_gates(const TubeVector& x) {
+    int n = x.size();
+    size_t nb_times = m_nogood_times.size();
+    m_nogood_gate_times.clear();
+    for (map<double,int>::const_iterator it = m_nogood_times.begin(); it != m_nogood_times.end(); ++it)
+      m_nogood_gate_times.push_back(it->first);
+    if (m_nogood_gates.size() < nb_times)
+      m_nogood_gates.resize(nb_times, IntervalVector(n));
+    for (int i=0; i<n; i++){
+      size_t j=0;
+      for (const Slice* s= x[i].first_slice(); s!=NULL && j<nb_times; s=s->next_slice()){
+	const Interval& dom = s->tdomain();
+	for (; j<nb_times && m_nogood_gate_times[j] < dom.ub(); j++)
+	  m_nogood_gates[j][i] = (m_nogood_gate_times[j] == dom.lb()) ? s->input_gate() : s->codomain();
+      }
+      for (; j<nb_times; j++)   // the last gate
+	m_nogood_gates[j][i] = x[i].last_slice()->output_gate();
+    }
+  }
 
-	  slice_step.push_back(step_max);
-	  if (step_max < DBL_MAX)  // to not take into account infinite gates in average computation
-	    {
-		nbsteps++;
-		step_threshold=(step_threshold*(nbsteps-1)+step_max)/nbsteps;
-	    }
+  // the gate of x at the decision time t, computed by nogood_gates
+  IntervalVector& Solver::nogood_gate(double t) {
+    size_t j = lower_bound(m_nogood_gate_times.begin(), m_nogood_gate_times.end(), t) - m_nogood_gate_times.begin();
+    return m_nogood_gates[j];
+  }
 
+  /* x (a subset of the initial tube) is refuted by a nogood whose decisions all contain its gates.
+     If only one decision d does not contain its gate, x without the gate d is refuted : the gate of x at d.t
+     is replaced by the hull of its part outside d.gate (when it is outside in one dimension only).
+     The gates of x are computed once per decision time (cf nogood_gates). */
+  bool Solver::nogood_refuted(TubeVector& x) {
+    nogood_gates(x);
+    for (size_t j=0; j<m_nogoods.size(); j++){
+      const Decision* outside = NULL;
+      int nb_outside = 0;
+      for (const Decision* d = m_nogoods[j].get(); d != NULL && nb_outside < 2; d = d->parent.get())
+	if (!nogood_gate(d->t).is_subset(d->gate))
+	  {nb_outside++; outside = d;}
+
+      if (nb_outside == 0)
+	{m_nogood_prunings++; return true;}
+      if (nb_outside == 1){
+	IntervalVector gate = nogood_gate(outside->t);
+	int dim = -1;
+	for (int i=0; i<gate.size(); i++)
+	  if (!gate[i].is_subset(outside->gate[i]))
+	    {if (dim >= 0) {dim = -1; break;} dim = i;}
+	if (dim < 0) continue;
+	const Interval& a = gate[dim];
+	const Interval& b = outside->gate[dim];
+	Interval trimmed = a;
+	if (b.lb() <= a.lb()) trimmed = Interval(b.ub(), a.ub());
+	else if (b.ub() >= a.ub()) trimmed = Interval(a.lb(), b.lb());
+	if (trimmed.diam() < a.diam()){
+	  x[dim].set(trimmed, outside->t);
+	  m_slices_tube = NULL;
+	  nogood_gate(outside->t)[dim] = x[dim](outside->t);
+	  m_nogood_trimmings++;
 	}
-	return step_threshold;
+      }
+    }
+    return false;
   }
 
-  void Solver::bisection(const TubeVector& x, list<pair<pair<int,double>,TubeVector> > &s, int level) {
+  /* split of the component dim of the gate at t of x (dim -1 : the largest bisectable component, as TubeVector::bisect)
+     into arity parts of the same diameter, or into 2 parts at ratio if arity is 2 or the component is unbounded.
+     x itself becomes the first part, the other parts are new tubes (to be deleted by the caller), without copying x more than necessary.
+     Returns false (x unchanged) if the gate cannot be bisected. */
+  bool Solver::try_split(TubeVector &x, double t, int dim, int arity, float ratio, vector<TubeVector*>& children) {
+    children.clear();
+    if (dim < 0){
+      IntervalVector gate = x(t);
+      double diam_max = -1.;
+      for (int i=0; i<gate.size(); i++)
+	if (is_bisectable(gate[i]) && gate[i].diam() > diam_max)
+	  {dim = i; diam_max = gate[i].diam();}
+      if (dim < 0) return false;
+    }
+    Interval gate = x[dim](t);
+    if (!is_bisectable(gate)) return false;
+
+    vector<Interval> parts;
+    if (arity <= 2 || gate.is_unbounded()){
+      pair<Interval,Interval> p_gate = gate.bisect(ratio);
+      parts.push_back(p_gate.first);
+      parts.push_back(p_gate.second);
+    }
+    else{
+      double lb = gate.lb();
+      for (int j=0; j<arity; j++){
+	double ub = (j==arity-1) ? gate.ub() : gate.lb() + (j+1)*(gate.diam()/arity);
+	if (ub > lb) parts.push_back(Interval(lb, ub));
+	lb = ub;
+      }
+      if (parts.size() < 2) return false;
+    }
+
+    children.push_back(&x);
+    for (size_t j=1; j<parts.size(); j++){
+      TubeVector* xj = new TubeVector(x);
+      (*xj)[dim].set(parts[j], t);
+      children.push_back(xj);
+    }
+    x[dim].set(parts[0], t);
+    return true;
+  }
+
+  /* ratio of the split of gate at the point refuted by a trial contraction : the refuted point separates the children,
+     whose trial contractions from the bisection time can then remove its neighbourhood ; m_bisection_ratio if the point
+     is not strictly inside the gate or the gate is unbounded */
+  float Solver::refuted_point_ratio(const Interval& gate, double point)
+  {
+    if (gate.is_unbounded() || !(gate.diam() > 0.)) return m_bisection_ratio;
+    double ratio = (point - gate.lb()) / gate.diam();
+    if (!(ratio > 0. && ratio < 1.)) return m_bisection_ratio;
+    return (float) min(max(ratio, (double) m_bisection_min_ratio), 1. - m_bisection_min_ratio);
+  }
+
+  /* hash of the path of the child-th child of a node of path parent (splitmix64 mixing) */
+  uint64_t Solver::path_hash(uint64_t parent, uint64_t child)
+  {
+    uint64_t z = parent + 0x9e3779b97f4a7c15ULL * (child + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  /* the node x is bisected : x itself becomes the first child, the second child is a new tube */
+  void Solver::bisection(TubeVector* x, list<SearchNode> &s, int level, TFnc* f, const shared_ptr<const Decision>& decisions) {
     if (m_trace) cout << "Bisection... (level " << level << ")" << endl;
-	    //	    if (f) bisection_guess (x,*f);  //TODO use bisection_guess
 	    double t_bisection;
+	    int dim_bisection = -1;   // -1 : largest component of the gate
+	    float ratio = m_bisection_ratio;   // split point when no refuted point is known
+	    Interval bisected_gate, refuted = Interval::EMPTY_SET;   // refuted part of the bisected gate component
 	      if (m_bisection_timept==0){
-		if (x.volume() < DBL_MAX)
-		  x.max_gate_diam(t_bisection);
-		else
-		  t_bisection=one_finite_gate(x);
+		if (x->volume() < DBL_MAX || !one_finite_gate(*x, t_bisection))
+		  x->max_gate_diam(t_bisection);
 	      }
 		  
 	      else if (m_bisection_timept==1)
-		t_bisection=x[0].tdomain().ub();
+		t_bisection=(*x)[0].tdomain().ub();
 	      else if  (m_bisection_timept==-1)
-		t_bisection=x[0].tdomain().lb();
+		t_bisection=(*x)[0].tdomain().lb();
 	      else if  (m_bisection_timept==2){
-		if (rand()%2)
-		  t_bisection=x[0].tdomain().lb();
+		if (m_rng()%2)
+		  t_bisection=(*x)[0].tdomain().lb();
 		else
-		  t_bisection=x[0].tdomain().ub();
+		  t_bisection=(*x)[0].tdomain().ub();
 	      }
 	      else if  (m_bisection_timept==3){
 	      if (level%2)
-		t_bisection=x[0].tdomain().lb();
+		t_bisection=(*x)[0].tdomain().lb();
 	      else
-		t_bisection=x[0].tdomain().ub();
+		t_bisection=(*x)[0].tdomain().ub();
+	      }
+	      else if  (m_bisection_timept==4){
+		pair<int,pair<double,double>> guess (-1, make_pair(0.,0.));
+		if (f && x->volume() < DBL_MAX)
+		  guess = bisection_guess(*x, *f, 2);
+		if (guess.first >= 0){
+		  dim_bisection = guess.first;
+		  t_bisection = guess.second.first;
+		  ratio = refuted_point_ratio((*x)[dim_bisection](t_bisection), guess.second.second);
+		  bisected_gate = (*x)[dim_bisection](t_bisection);
+		  refuted = m_guess_refuted & bisected_gate;
+		}
+		else
+		  x->max_gate_diam(t_bisection);
 	      }
 
 	   
 	      
 	    bisections++;
 	    level++;
-            try{
-	      pair<TubeVector,TubeVector> p_x = x.bisect(t_bisection);
-
-	      s.push_front(make_pair(make_pair(level,t_bisection), p_x.second));       
-	      s.push_front(make_pair(make_pair(level,t_bisection), p_x.first));
-              if (m_trace)	    
-		cout << " t_bisection " << t_bisection << " x volume " << x.volume() << " nb_slices " << x.nb_slices()  << endl;
-	   
+	    if (m_trace)
+	      cout << " x volume " << x->volume() << " nb_slices " << x->nb_slices()  << endl;
+	    vector<TubeVector*> children;
+	    if (!try_split(*x, t_bisection, dim_bisection, m_bisection_arity, ratio, children)){
+	      // when the bisection time was not bisectable, change to largest gate
+	      x->max_gate_diam(t_bisection);
+	      dim_bisection = -1;
+	      if (!try_split(*x, t_bisection, dim_bisection, m_bisection_arity, m_bisection_ratio, children))  // all gates degenerated
+		throw Exception("Solver::bisection", "unable to bisect, degenerated gates");
+	      refuted = Interval::EMPTY_SET;
 	    }
-	    catch (Exception &)   // when the bisection time was not bisectable, change to largest gate
-	      {	 
-		// cout << " bisection exception " << endl;
-		x.max_gate_diam(t_bisection);
-	        pair<TubeVector,TubeVector> p_x = x.bisect(t_bisection);
-
-             if (m_trace)	      cout << " t_bisection " << t_bisection << " x volume " << x.volume() << " nb_slices " << x.nb_slices()  << endl;
-	    
-		s.push_front(make_pair(make_pair(level,t_bisection), p_x.second));     
-		s.push_front(make_pair(make_pair(level,t_bisection), p_x.first));
+	    bool bounded = x->volume() < DBL_MAX;   // x is the first child, it can be deleted
+	    if (!refuted.is_empty() && children.size() == 2)
+	      for (size_t j=0; j<2; j++){
+		// the children are the parts of the gate around the refuted interval, a degenerated part is refuted
+		Interval gate = (j==0) ? Interval(bisected_gate.lb(), refuted.lb()) : Interval(refuted.ub(), bisected_gate.ub());
+		if (gate.is_empty() || gate.is_degenerated()){
+		  if (m_trace) cout << " child " << j << " refuted by the bisection guess " << endl;
+		  delete children[j];
+		  children[j] = NULL;
+		}
+		else
+		  (*children[j])[dim_bisection].set(gate, t_bisection);
+	      }
+	    if (m_trace) {
+	      cout << " t_bisection " << t_bisection;
+	      if (dim_bisection >= 0) cout << " dim " << dim_bisection;
+	      cout << endl;
+	    }
+
+	    vector<shared_ptr<const Decision> > child_decisions(children.size());
+	    if (m_nogood_capacity > 0)
+	      for (size_t j=0; j<children.size(); j++)
+		if (children[j])
+		  child_decisions[j] = make_shared<const Decision>(Decision{t_bisection, (*children[j])(t_bisection), decisions});
+
+	    // trial contractions : the children refuted by CtcDeriv from the bisection time are not pushed
+	    if (m_bisection_trial_contraction && f && bounded)
+	      for (size_t j=0; j<children.size(); j++){
+		if (!children[j]) continue;
+		deriv_contraction(*children[j], *f, t_bisection, true);
+		if (children[j]->is_empty()){
+		  if (m_trace) cout << " child " << j << " refuted " << endl;
+		  add_nogood(child_decisions[j]);
+		  delete children[j];
+		  children[j] = NULL;
+		}
+	      }
+
+	    for (int j=children.size()-1; j>=0; j--)   // the first child on top of the stack
+	      if (children[j]){
+		SearchNode child = {level, t_bisection, children[j], NULL, child_decisions[j], path_hash(m_node_path, j+1), -1};
+		s.push_front(child);
+		m_open_slices += children[j]->nb_slices();
 	      }
   }
 
   
   const list<TubeVector> Solver::solve(const TubeVector& x0,  TFnc& f, void (*ctc_func)(TubeVector&, double t0, bool incremental)) { return (solve(x0,&f,ctc_func));}
-  
 
-  const list<TubeVector> Solver::solve(const TubeVector& x0, void (*ctc_func)(TubeVector&,double t0, bool incremental)) {return (solve(x0,NULL, ctc_func));}
+  const SolverResult Solver::solve_result(const TubeVector& x0,  TFnc& f, void (*ctc_func)(TubeVector&, double t0, bool incremental)) const { return (solve_result(x0,&f,ctc_func));}
 
- 
-  const list<TubeVector> Solver::solve(const TubeVector& x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental))
+  const SolverResult Solver::solve_result(const TubeVector& x0, void (*ctc_func)(TubeVector&, double t0, bool incremental)) const { return (solve_result(x0,NULL,ctc_func));}
 
+  /* the search runs on a copy of the solver (its own counters, random generator, buffers, threads and nogoods),
+     the solver itself is only read */
+  const SolverResult Solver::solve_result(const TubeVector& x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental)) const
   {
-    bisections=0;
-    solving_time=0.0;
-    assert(x0.size() == m_max_thickness.size());
+    Solver context(*this);
+    SolverResult result;
+    result.solutions = context.solve(x0, f, ctc_func);
+    result.solving_time = context.solving_time;
+    result.bisections = context.bisections;
+    return result;
+  }
+  
 
-    int sol_i = 0;
-    clock_t t_start = clock();
+  const list<TubeVector> Solver::solve(const TubeVector& x0, void (*ctc_func)(TubeVector&,double t0, bool incremental)) {return (solve(x0,NULL, ctc_func));}
 
-    #if GRAPHICS
-    m_fig->show(true);
-    #endif
-    
-    double t_init=x0[0].tdomain().lb();
-    list<pair<pair<int,double>,TubeVector> > s;
-    s.push_back(make_pair(make_pair(0,t_init), x0));
-    list<TubeVector> l_solutions;
+  /* the pending nodes of a search, the node in process and the node store : they are released if the search is interrupted
+     by an exception (the search ends with no pending node and no store otherwise) */
+  struct PendingNodes
+  {
+    list<SearchNode>& s;
+    SearchNode& node;   // its tube is NULL once deleted or reused by a child
+    NodeStore*& store;
 
-    while(!s.empty())
+    ~PendingNodes()
     {
-      int level = s.front().first.first;
-      double t_bisect= s.front().first.second;
-     
-      TubeVector x = s.front().second;
-      s.pop_front();
+      NodeStore::release(s, &node);
+      delete store;
+      store = NULL;
+    }
+  };
+
+ 
+  /* processing of a node popped from the search stack (its tube is rebuilt first if it is compact) : contraction, refinings, then either a solution added to l_solutions,
+     or the children of its bisection pushed on top of s, or a refutation. The tube of the node is deleted or reused by a child (node.x is then NULL).
+     The random choices of the node depend only on its path (the generator is seeded by node.path). */
+  void Solver::process_node(SearchNode& node, const TubeVector& x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental),
+			    list<SearchNode>& s, list<TubeVector>& l_solutions)
+  {
+      bool rebuilt = NodeStore::expand(node, x0);   // a compact node has lost its codomains
+      m_open_slices -= node.x->nb_slices();
+      m_node_path = node.path;
+      m_slices_tube = NULL;   // a new tube, possibly at the address of the previous one
+      m_rng.seed((unsigned int)(node.path ^ (node.path >> 32)));
+      int level = node.level;
+      double t_bisect= node.t_bisect;
+      TubeVector& x = *node.x;
+
+      if (!m_nogoods.empty() && nogood_refuted(x)){
+	if (m_trace) cout << " node refuted by a nogood " << endl;
+	delete node.x;
+	node.x = NULL;
+	return;
+      }
 
       bool emptiness;
       double volume_before_refining;
       
       bool incremental =0;
-      if (level >0) incremental=1;
+      if (level >0 && !rebuilt) incremental=1;
 
-      contraction_step(x, f, ctc_func,incremental,t_bisect);
+      if (level==0 && m_contraction_cache){ // first contraction : from the cache, or stored in the cache
+	m_slices_tube = NULL;
+	if (m_contraction_cache->contract(x)){
+	  if (m_trace) cout << " initial tube contracted by the cache " << endl;
+	  if (!x.is_empty()) contraction_step(x, f, ctc_func,incremental,t_bisect);
+	}
+	else{
+	  contraction_step(x, f, ctc_func,incremental,t_bisect);
+	  m_contraction_cache->add(x0, x);
+	}
+      }
+      else
+	contraction_step(x, f, ctc_func,incremental,t_bisect);
      
       emptiness = x.is_empty();
       if (trace && !emptiness)    cout <<  " volume after contraction " << x.volume()  << endl;      
@@ -390,7 +949,7 @@ namespace tubex
         volume_before_refining = x.volume();
         // 1. Refining
 	if(m_refining_fxpt_ratio >= 0.0)
-	  if (! refining(x))
+	  if (! refining(x, level))
 	    {break;}
 	if (m_trace) {
 	  cout << " nb_slices after refining step " << x[0].nb_slices() << endl;
@@ -399,13 +958,14 @@ namespace tubex
 	contraction_step(x, f, ctc_func,false,x[0].tdomain().lb() );
 	emptiness = x.is_empty();
 	if (m_trace && !emptiness) cout << " volume after contraction " <<  x.volume() << endl;
-
+	// 3. Coarsening of the slices no more useful
+	if (!emptiness) coarsening(x, t_bisect);
       }
       
       while(!emptiness
 	    && !(stopping_condition_met(x))
 	    && !(fixed_point_reached(volume_before_refining, x.volume(), m_refining_fxpt_ratio)));
-      // 3. Bisection
+      // 4. Bisection
       emptiness=x.is_empty();
       if(!emptiness)
         {
@@ -419,22 +979,81 @@ namespace tubex
               m_fig->show(true);
             #endif
 	    */
-              sol_i++;
-	      if (m_trace) cout << "solution_" << sol_i <<  " vol  " << x.volume() << " max diam " << x.max_diam() << endl;
+	      if (m_trace) cout << "solution_" << l_solutions.size() <<  " vol  " << x.volume() << " max diam " << x.max_diam() << endl;
           }
 
           else
           {
-            bisection(x,s,level);
+	    coarsening(x, t_bisect);
+            bisection(node.x,s,level,f,node.decisions);  // node.x is reused by the first child
+	    node.x = NULL;
+	    return;
 	  }
 
     	}
+      else
+	add_nogood(node.decisions);
+      delete node.x;
+      node.x = NULL;
+  }
+
+  const list<TubeVector> Solver::solve(const TubeVector& x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental))
+
+  {
+    bisections=0;
+    solving_time=0.0;
+    m_var3b_trials=0;
+    m_nogoods.clear();
+    m_nogood_times.clear();
+    m_nogood_prunings=0;
+    m_nogood_trimmings=0;
+    m_var3b_start_rate.clear();   // var3b statistics of the previous solving
+    m_var3b_failures.clear();
+    m_var3b_skip.clear();
+    if (m_derivative_cache) m_derivative_cache->reset();   // f may be another function at the same address
+    assert(x0.size() == m_max_thickness.size());
+
+    chrono::steady_clock::time_point t_start = chrono::steady_clock::now();  // wall-clock : threads may be used
+
+    #if GRAPHICS
+    if (m_fig) m_fig->show(true);
+    #endif
+    
+    double t_init=x0[0].tdomain().lb();
+    list<SearchNode> s;     // the tubes of the pending nodes are moved by pointer, never copied
+    SearchNode node = {0, t_init, NULL, NULL, nullptr, 0, -1};   // the node in process
+    PendingNodes pending = {s, node, m_node_store};
+    if (m_node_memory_budget > 0)
+      m_node_store = new NodeStore(m_node_memory_budget, m_spill_file);
+
+    SearchNode root = {0, t_init, new TubeVector(x0), NULL, nullptr, path_hash(m_seed, 0), -1};
+    s.push_back(root);
+    m_open_slices = x0.nb_slices();
+    list<TubeVector> l_solutions;
+
+    if (m_search_wave_width > 0)
+      deterministic_search(s, x0, f, ctc_func, l_solutions);
+    else
+      while(!s.empty())
+	{
+	  node = s.front();
+	  s.pop_front();
+	  if (m_node_store) m_node_store->reload(node);
+	  process_node(node, x0, f, ctc_func, s, l_solutions);
+	  if (m_compact_nodes) NodeStore::compact(s, 1);   // the next node stays expanded
+	  if (m_node_store) m_node_store->spill(s);
+	}
+
+    if (m_node_store){
+      if (m_trace) cout << "Spilled nodes " << m_node_store->nb_spills() << endl;
+      delete m_node_store;
+      m_node_store = NULL;
     }
     
     
     if (m_trace){
       cout << endl;
-      cout << "Solving time " << (double)(clock() - t_start)/CLOCKS_PER_SEC << endl;
+      cout << "Solving time " << chrono::duration<double>(chrono::steady_clock::now() - t_start).count() << endl;
     }
 
     if (m_trace)
@@ -442,7 +1061,7 @@ namespace tubex
    
     while (l_solutions.size()>1)
       {
-      int k = l_solutions.size();
+      size_t k = l_solutions.size();
       clustering(l_solutions);
       if (k==l_solutions.size())
 	{ if (m_trace) cout << " end of clustering " << endl;
@@ -451,10 +1070,14 @@ namespace tubex
 	print_solutions(l_solutions);
       }
     
-    double total_time =  (double)(clock() - t_start)/CLOCKS_PER_SEC;
+    double total_time = chrono::duration<double>(chrono::steady_clock::now() - t_start).count();
     solving_time=total_time;
     if (m_trace)  cout << "Total time with clustering: " << solving_time << endl;
     if (m_trace) cout << "Number of bisections " << bisections << endl;
+    if (m_trace && m_var3b_fxpt_ratio >= 0.0) cout << "Number of var3b trial contractions " << m_var3b_trials << endl;
+    if (m_trace && m_derivative_cache) cout << "Derivative slices evaluated " << m_derivative_cache->nb_evaluated() << " reused " << m_derivative_cache->nb_reused() << endl;
+    if (m_trace && m_nogood_capacity > 0) cout << "Nodes refuted by nogoods " << m_nogood_prunings << " trimmed " << m_nogood_trimmings << endl;
+    release_worker_fncs();
     return l_solutions;
     }
   
@@ -464,7 +1087,6 @@ namespace tubex
     assert(!l_tubes.empty());
     list<pair<int,TubeVector> > l_clustered;
     list<pair<int,TubeVector> >::iterator it1, it2;
-    int size= l_tubes.size();
     for(it1 = l_tubes.begin(); it1 != l_tubes.end(); ++it1)     
       {
 	bool clustering = false;
@@ -522,42 +1144,54 @@ namespace tubex
 
   /*   more efficient algorithm in case of tubes with different slicings : no need to compute  the tube intersection  TODO test this algorithm */
 
-  bool Solver::empty_intersection( TubeVector & tubevector1, TubeVector & tubevector2)
+  // [lb1,ub1] & [lb2,ub2] is empty
+  static bool empty_bounds_intersection(double lb1, double ub1, double lb2, double ub2)
   {
+    return !(std::max(lb1,lb2) <= std::min(ub1,ub2));
+  }
 
+  bool Solver::empty_intersection( TubeVector & tubevector1, TubeVector & tubevector2)
+  {
+      m_slices.load(tubevector1);
+      m_slices_tube = NULL;   // not the tube of the node
+      SliceArrays slices2;
+      slices2.load(tubevector2);
+      int nb1 = m_slices.nb_slices();
+      int nb2 = slices2.nb_slices();
+      const double* t1_ub = m_slices.t_ub();
+      const double* t2_lb = slices2.t_lb();
+      const double* t2_ub = slices2.t_ub();
       for (int k=0; k< tubevector1.size() ; k++)
-         
-	 {Slice* s2=tubevector2[k].first_slice();
-	   Slice* s1=tubevector1[k].first_slice();
-	   if ((s2->input_gate()&s1->codomain()).is_empty()
+	 {
+	   const double* c1_lb = m_slices.codomain_lb(k); const double* c1_ub = m_slices.codomain_ub(k);
+	   const double* g1_lb = m_slices.gate_lb(k); const double* g1_ub = m_slices.gate_ub(k);
+	   const double* c2_lb = slices2.codomain_lb(k); const double* c2_ub = slices2.codomain_ub(k);
+	   const double* g2_lb = slices2.gate_lb(k); const double* g2_ub = slices2.gate_ub(k);
+
+	   // first slices
+	   if (empty_bounds_intersection(g2_lb[0], g2_ub[0], c1_lb[0], c1_ub[0])
 	       ||
-	       (s1->input_gate()&s2->codomain()).is_empty())
-	     {cout << "first slice " << endl; 
+	       empty_bounds_intersection(g1_lb[0], g1_ub[0], c2_lb[0], c2_ub[0]))
+	     {if (m_trace) cout << "first slice " << endl; 
 	       return true;}
-	     
-	   for (const Slice* s= tubevector1[k].first_slice(); s!=NULL; s=s->next_slice()){
-
-	     while (s2->tdomain().ub() <= s->tdomain().lb()){
-          
-	       s2=s2->next_slice();}
-             
-	     if ((s2->input_gate()&s->codomain()).is_empty())
-	       {cout << " middle s2 " << endl; 
-				 cout << *s << endl;
-		                 cout << *s2 << endl; 
-		 return true;}
-	     if (s->tdomain().ub() <= s2->tdomain().lb())
-	      if ((s->output_gate() & s2->codomain()).is_empty())
-		{cout << " middle s "<< endl;  return true;}
-	   
-	     s2=tubevector2[k].last_slice();
-	     s1=tubevector1[k].last_slice();
-	     if ((s2->output_gate()&s1->codomain()).is_empty()
-		 ||
-		 (s1->output_gate()&s2->codomain()).is_empty())
-	       {cout << " last slice " << endl; 
+
+	   // last slices
+	   if (empty_bounds_intersection(g2_lb[nb2], g2_ub[nb2], c1_lb[nb1-1], c1_ub[nb1-1])
+	       ||
+	       empty_bounds_intersection(g1_lb[nb1], g1_ub[nb1], c2_lb[nb2-1], c2_ub[nb2-1]))
+	     {if (m_trace) cout << " last slice " << endl; 
+	       return true;}
+
+	   int j=0;  // slice of tubevector2
+	   for (int i=0; i< nb1; i++){
+	     while (t2_ub[j] <= m_slices.t_lb()[i])
+	       j++;
+	     if (empty_bounds_intersection(g2_lb[j], g2_ub[j], c1_lb[i], c1_ub[i]))
+	       {if (m_trace) cout << " middle s2 " << endl; 
 		 return true;}
-	   
+	     if (t1_ub[i] <= t2_lb[j])
+	       if (empty_bounds_intersection(g1_lb[i+1], g1_ub[i+1], c2_lb[j], c2_ub[j]))
+		 {if (m_trace) cout << " middle s "<< endl;  return true;}
 	   }
 	 }
   return false;
@@ -581,15 +1215,19 @@ namespace tubex
   
     
   void Solver::display_solutions(const list<TubeVector> & l_solutions) {
+      #if GRAPHICS
       int i=0;
+      #endif
       list<TubeVector>::const_iterator it;
       for(it = l_solutions.begin(); it != l_solutions.end(); ++it){
             #if GRAPHICS // displaying solution
               i++;
 	      ostringstream o; o << "solution_" << i;
 	      const TubeVector* tv= &(*it);
-	      m_fig->add_tube(tv, o.str());
-              m_fig->show(true);
+	      if (m_fig) {
+		m_fig->add_tube(tv, o.str());
+		m_fig->show(true);
+	      }
             #endif
     
       }
@@ -611,9 +1249,10 @@ namespace tubex
   }
  
 
+  /* the stopping tests walk the slices once and return at the first slice thicker than the max thickness :
+     a copy into m_slices would cost more than this single scan */
   bool Solver::diam_stopping_condition(const TubeVector& x)
   {
-  
     for(int i = 0 ; i < x.size() ; i++){
       for(const Slice *s = x[i].first_slice() ; s != NULL ; s= s->next_slice())
 	{if (s->codomain().diam()> m_max_thickness[i])
@@ -626,12 +1265,14 @@ namespace tubex
 
   bool Solver::gate_stopping_condition(const TubeVector& x)
   {
-    for(int i = 0 ; i < x.size() ; i++)
-      {
-	double tmaxgate;
-	if(x[i].max_gate_diam(tmaxgate) > m_max_thickness[i])
-	  return false;
-      }
+    for(int i = 0 ; i < x.size() ; i++){
+      for(const Slice *s = x[i].first_slice() ; s != NULL ; s= s->next_slice())
+	{if (s->input_gate().diam()> m_max_thickness[i])
+	    return false;
+	}
+      if (x[i].last_slice()->output_gate().diam()> m_max_thickness[i])
+	return false;
+    }
     return true;
   }
 
@@ -682,23 +1323,39 @@ namespace tubex
     }
   }
 
-  void Solver::deriv_contraction (TubeVector &x, const TFnc& f, double t0, bool incremental){
+  /* the derivative tube of x, from the derivative cache (only the changed slices are evaluated, by the threads 
+     of the solver if any) or evaluated in v_eval */
+  const TubeVector& Solver::derivative(TubeVector &x, const TFnc& f, bool cached, TubeVector*& v_eval){
+    if (cached){
+      if (!m_derivative_cache) m_derivative_cache = new DerivativeCache();
+      if (m_nb_threads != 1)  // the worker copies only evaluate f
+	return m_derivative_cache->eval(f, x, thread_pool(), &worker_fncs(const_cast<TFnc&>(f)));
+      return m_derivative_cache->eval(f, x);
+    }
+    v_eval = new TubeVector(f.eval_vector(x));
+    return *v_eval;
+  }
+
+  void Solver::deriv_contraction (TubeVector &x, const TFnc& f, double t0, bool incremental, bool cached){
     CtcDeriv ctc;
     //    cout << " x before ctc deriv " << x << " volume " << x.volume() << " empty : " << x.is_empty() << endl;
     ctc.set_fast_mode(true);
-    //    ctc.contract(x, f.eval_vector(x), TimePropag::FORWARD);
-    //    ctc.contract(x, f.eval_vector(x), TimePropag::BACKWARD);
+    TubeVector* v_eval = NULL;
+    const TubeVector& v = derivative(x, f, cached, v_eval);
+    //    ctc.contract(x, v, TimePropag::FORWARD);
+    //    ctc.contract(x, v, TimePropag::BACKWARD);
     if (incremental && t0==x.tdomain().lb())
-      ctc.contract(x, f.eval_vector(x), TimePropag::FORWARD);
+      ctc.contract(x, v, TimePropag::FORWARD);
     else if (incremental && t0==x.tdomain().ub())
-      ctc.contract(x, f.eval_vector(x), TimePropag::BACKWARD);
+      ctc.contract(x, v, TimePropag::BACKWARD);
     else
-      ctc.contract(x, f.eval_vector(x), TimePropag::FORWARD | TimePropag::BACKWARD);
+      ctc.contract(x, v, TimePropag::FORWARD | TimePropag::BACKWARD);
+    delete v_eval;
 
     //    cout << " x  after ctc deriv " << x << " volume " << x.volume() << " empty : " << x.is_empty() <<endl;
   }
 
-  void Solver::integration_contraction(TubeVector &x, const TFnc& f, double t0, bool incremental){
+  void Solver::integration_contraction(TubeVector &x, const TFnc& f, double t0, bool incremental, bool cached){
     
     DynCtc* ctc_dyncid;
     CtcIntegration* ctc_integration;
@@ -719,7 +1376,9 @@ namespace tubex
     //    if(x.volume() >= DBL_MAX ||  x.nb_slices() == 1 ) ctc_integration->set_picard_mode(true);
     if(x.volume() >= DBL_MAX) ctc_integration->set_picard_mode(true);
 
-    TubeVector v = f.eval_vector(x);
+    TubeVector* v_eval = NULL;
+    TubeVector v = derivative(x, f, cached, v_eval);  // a copy : v is also contracted by CtcIntegration
+    delete v_eval;
     incremental=false ; // stronger contraction without incrementality ; comment this line for incrementality
 
     if (incremental) // incrementality if incremental and no other function : not used (cf previous line)
@@ -796,18 +1455,24 @@ namespace tubex
 			    void (*ctc_func) (TubeVector&,double t0,bool incremental),
 			    bool incremental, double t0 , bool v3b)
   {
+    m_slices_tube = NULL;   // x is contracted
     if (ctc_func && (!v3b || m_var3b_external_contraction))
       { 
 	ctc_func(x, t0, incremental);  // Other constraints contraction
 	incremental=false;
       }
     if (f){                     // ODE contraction
+      int contraction_mode = v3b ? 4 : m_contraction_mode;   // CtcDeriv inside var3b
 	  
-      if (m_contraction_mode==4){   // CtcPicard + CtcDeriv
+      if (!v3b && m_time_segments > 1 && !f->is_intertemporal() && x.nb_slices() > 1
+	  && (contraction_mode==4 || contraction_mode <=2)){   // segments contracted in parallel
+	time_segments_contraction(x,*f);
+      }
+      else if (contraction_mode==4){   // CtcPicard + CtcDeriv
 	if (!v3b) picard_contraction(x,*f);
 	deriv_contraction(x,*f, t0, incremental);
       }
-      else if (m_contraction_mode <=2 ){                   // CtcIntegration 
+      else if (contraction_mode <=2 ){                   // CtcIntegration 
 	  integration_contraction(x,*f,t0,incremental);
       }
 	  //	  cout << " tube after contraction " << x << " volume after " << x.volume() << " nb_slices  " << x[0].nb_slices() <<endl;
@@ -839,76 +1504,178 @@ namespace tubex
     //    cout << " volume before var3b " << x.volume() << endl;
 
    
-    int contraction_mode = m_contraction_mode;
-    m_contraction_mode=4;  // var3B calls CtcDeriv as internal ODE contractor 
+    // var3B calls CtcDeriv as internal ODE contractor (cf contraction with v3b) :
     // incremental contractors using CtcIntegration are too weak and non incremental contractors as
     // CtcIntegration with CtcDyncid or CtcDyncidGuess are too costly
     //    cout << " var3b " << x << endl;
+    if (m_var3b_timepoints > 1 && x.nb_slices() > 1){
+      vector<double> times;
+      var3b_times(x, m_var3b_timepoints, times);
+      if (f && (!ctc_func || !m_var3b_external_contraction) && thread_pool()->nb_threads() > 1)
+	parallel_var3b(x, f, times);
+      else
+	for (size_t j=0; j<times.size() && !x.is_empty(); j++)
+	  var3b_at(x, f, ctc_func, times[j]);
+      return;
+    }
+
     double t_bisection;
     if (m_var3b_timept==1)
       t_bisection=x[0].tdomain().ub();
     else if (m_var3b_timept==-1)
       t_bisection=x[0].tdomain().lb();
     else  if (m_var3b_timept==2){
-      if (rand()%2)
+      if (m_rng()%2)
 	t_bisection=x[0].tdomain().lb();
       else
 	t_bisection=x[0].tdomain().ub();
     }
     else
       x.max_gate_diam(t_bisection);  
-    for(int k=0; k<x.size() ; k++)
-      {
-
-	double rate=m_var3b_bisection_minrate;
+    var3b_at(x, f, ctc_func, t_bisection);
+    //    cout << " volume after var3b " << x.volume() << endl;
+  }
 
-	while (rate < m_var3b_bisection_maxrate){
-	  try
-	    {pair<TubeVector,TubeVector> p_x = x.bisect(t_bisection,k,rate);
-             
 
-	      fixed_point_contraction(p_x.first, f, ctc_func, m_var3b_propa_fxpt_ratio, true, t_bisection, true);
 
-              if (p_x.first.is_empty())
-		x=p_x.second;
-	     //	     else {x = p_x.second | p_x.first ; break;}
-	     else {p_x.second|= p_x.first; x = p_x.second  ; break;} // no slicing
+  // shaving of both sides of the gate at t_bisection in every dimension
+  void Solver::var3b_at(TubeVector &x, TFnc * f,void (*ctc_func) (TubeVector&,double t0,bool incremental), double t_bisection)
+  {
+    for(int k=0; k<x.size() ; k++)
+      {
 
-	     rate= m_var3b_bisection_ratefactor*rate;
+	if (m_var3b_mode==1)
+	  var3b_adaptive_shave(x, f, ctc_func, k, false, t_bisection);
+	else if (m_var3b_mode==2)
+	  var3b_dichotomic_shave(x, f, ctc_func, k, false, t_bisection);
+	else
+	  var3b_shave(x, f, ctc_func, k, false, t_bisection, m_var3b_bisection_minrate);
 
-	    }
-	  catch (Exception& )
-	    {break;}
-	}
+	fixed_point_contraction(x,f, ctc_func, m_var3b_propa_fxpt_ratio, true, t_bisection, true);
 
+	if (m_var3b_mode==1)
+	  var3b_adaptive_shave(x, f, ctc_func, k, true, t_bisection);
+	else if (m_var3b_mode==2)
+	  var3b_dichotomic_shave(x, f, ctc_func, k, true, t_bisection);
+	else
+	  var3b_shave(x, f, ctc_func, k, true, t_bisection, m_var3b_bisection_minrate);
 
-	fixed_point_contraction(x,f, ctc_func, m_var3b_propa_fxpt_ratio, true, t_bisection, true);
+	fixed_point_contraction(x,f , ctc_func, m_var3b_propa_fxpt_ratio, true, t_bisection,true);
 
-	rate = 1 - m_var3b_bisection_minrate;
-       
-	while (rate > 1-m_var3b_bisection_maxrate ){
-	  try{
-	    pair<TubeVector,TubeVector> p_x = x.bisect(t_bisection,k,rate);
+      }
+  }
 
+  /* the gates are divided into nb_times windows of consecutive gates, the widest gate (max diameter in all dimensions) 
+     of each window is chosen ; the degenerated windows are not shaved */
+  void Solver::var3b_times(const TubeVector &x, int nb_times, vector<double>& times)
+  {
+    load_slices(x);
+    int nb_slices = m_slices.nb_slices();
+    int nb_gates = nb_slices + 1;
+    nb_times = min(nb_times, nb_gates);
+    times.clear();
+    for (int j=0; j<nb_times; j++){
+      int g_begin = (int)((long)j*nb_gates/nb_times);
+      int g_end = (int)((long)(j+1)*nb_gates/nb_times);
+      int g_max = -1; double diam_max = 0.;
+      for (int g=g_begin; g<g_end; g++){
+	double diam = 0.;
+	for (int i=0; i<x.size(); i++)
+	  diam = max(diam, m_slices.gate_ub(i)[g] - m_slices.gate_lb(i)[g]);
+	if (diam > diam_max) {diam_max = diam; g_max = g;}
+      }
+      if (g_max >= 0)
+	times.push_back(g_max < nb_slices ? m_slices.t_lb()[g_max] : m_slices.t_ub()[nb_slices-1]);
+    }
+  }
 
-	    fixed_point_contraction(p_x.second, f, ctc_func, m_var3b_propa_fxpt_ratio, true, t_bisection, true);
+  /* shaving of a side (lower or upper) of the gate at t of the component k of x : the slivers of fraction rate, rate*ratefactor, ...
+     (each one of the remaining gate) are removed while refuted by the contraction ; returns the last refuted fraction, 0 if none */
+  double Solver::var3b_shave(TubeVector &x, TFnc * f,void (*ctc_func) (TubeVector&,double t0,bool incremental), int k, bool upper, double t, double rate)
+  {
+    double refuted = 0.;
+    while (rate < m_var3b_bisection_maxrate && is_bisectable(x[k](t))){
+      pair<TubeVector,TubeVector> p_x = x.bisect(t,k, upper ? 1-rate : rate);
+      TubeVector& sliver = upper ? p_x.second : p_x.first;
+      TubeVector& remainder = upper ? p_x.first : p_x.second;
+      m_var3b_trials++;
+
+      fixed_point_contraction(sliver, f, ctc_func, m_var3b_propa_fxpt_ratio, true, t, true);
+
+      if (sliver.is_empty())
+	{x = remainder; refuted = rate;}
+      //	     else {x = remainder | sliver ; break;}
+      else {remainder |= sliver; x = remainder; break;} // no slicing
+      rate = m_var3b_bisection_ratefactor*rate;
+    }
+    return refuted;
+  }
 
-	    if (p_x.second.is_empty())
-	       x=p_x.first;
-	     //	     else {x = p_x.first |  p_x.second ; break;}
-	     else {p_x.first |= p_x.second ; x= p_x.first ; break;}   // no slicing
-	     rate=1-m_var3b_bisection_ratefactor*(1-rate);
+  /* fraction of a gate removed by var3b_shave when all its slivers are refuted : 1 - (1-minrate)(1-2 minrate)(1-4 minrate)...
+     (about 51% with the default rates) */
+  double Solver::var3b_geometric_reach()
+  {
+    double kept = 1.;
+    for (double rate = m_var3b_bisection_minrate; rate < m_var3b_bisection_maxrate; rate *= m_var3b_bisection_ratefactor)
+      kept *= 1 - rate;
+    return 1 - kept;
+  }
 
-	  }
-	  catch (Exception& )
-	    {break;}
-	}
-	fixed_point_contraction(x,f , ctc_func, m_var3b_propa_fxpt_ratio, true, t_bisection,true);
+  /* binary search of the largest refuted fraction (of the initial gate) in [0, reach], reach being the fraction the geometric
+     shaving can remove (var3b_geometric_reach) : the first trial removes reach at once ; a refuted fraction is removed and becomes
+     the lower bound of the search, a non refuted one the upper bound. The sliver of a trial goes from the current bound of the gate,
+     which a non refuted sliver may have contracted, to the fraction of the initial gate.
+     The search stops after m_var3b_dichotomy_trials trials or when the bounds are closer than minrate. */
+  void Solver::var3b_dichotomic_shave(TubeVector &x, TFnc * f,void (*ctc_func) (TubeVector&,double t0,bool incremental), int k, bool upper, double t)
+  {
+    Interval gate0 = x[k](t);
+    double lo = 0.;                            // fraction already removed
+    double hi = var3b_geometric_reach();       // smallest fraction known as not refuted
+    for (int trial=0; trial < m_var3b_dichotomy_trials && hi - lo >= m_var3b_bisection_minrate && is_bisectable(x[k](t)); trial++){
+      double r = (trial==0) ? hi : 0.5*(lo+hi);
+      Interval gate = x[k](t);
+      double p = upper ? gate0.ub() - r*gate0.diam() : gate0.lb() + r*gate0.diam();   // end of the sliver
+      double rate = (upper ? gate.ub() - p : p - gate.lb()) / gate.diam();          // w.r.t. the current gate
+      if (rate <= 0.) {lo = r; continue;}   // already removed by a contracted sliver
+      if (rate >= 1.) break;
+      pair<TubeVector,TubeVector> p_x = x.bisect(t,k, upper ? 1-rate : rate);
+      TubeVector& sliver = upper ? p_x.second : p_x.first;
+      TubeVector& remainder = upper ? p_x.first : p_x.second;
+      m_var3b_trials++;
+
+      fixed_point_contraction(sliver, f, ctc_func, m_var3b_propa_fxpt_ratio, true, t, true);
+
+      if (sliver.is_empty())
+	{x = remainder; lo = r;}
+      else
+	{remainder |= sliver; x = remainder; hi = r;} // no slicing
+    }
+  }
 
-	
-      }
-    m_contraction_mode=contraction_mode;
-    //    cout << " volume after var3b " << x.volume() << endl;
+  /* the shaving of a side starts at the fraction refuted the last time on this side, after a failure the next start
+     is lower, and after m_var3b_skip_threshold successive failures the side is skipped during 1, 2, 4, ... 16 calls */
+  void Solver::var3b_adaptive_shave(TubeVector &x, TFnc * f,void (*ctc_func) (TubeVector&,double t0,bool incremental), int k, bool upper, double t)
+  {
+    if ((int)m_var3b_start_rate.size() != 2*x.size()){
+      m_var3b_start_rate.assign(2*x.size(), m_var3b_bisection_minrate);
+      m_var3b_failures.assign(2*x.size(), 0);
+      m_var3b_skip.assign(2*x.size(), 0);
+    }
+    int side = 2*k + (upper ? 1 : 0);
+    if (m_var3b_skip[side] > 0)
+      {m_var3b_skip[side]--; return;}
+
+    double refuted = var3b_shave(x, f, ctc_func, k, upper, t, m_var3b_start_rate[side]);
+    if (refuted > 0.){
+      m_var3b_start_rate[side] = refuted;
+      m_var3b_failures[side] = 0;
+    }
+    else{
+      m_var3b_start_rate[side] = max((double) m_var3b_bisection_minrate, m_var3b_start_rate[side] / m_var3b_bisection_ratefactor);
+      m_var3b_failures[side]++;
+      if (m_var3b_failures[side] >= m_var3b_skip_threshold)
+	m_var3b_skip[side] = 1 << min(m_var3b_failures[side] - m_var3b_skip_threshold, 4);
+    }
   }
 
 
@@ -13,8 +13,14 @@
 #ifndef __TUBEX_SOLVER_H__
 #define __TUBEX_SOLVER_H__
 
+#include <cstdint>
 #include <list>
+#include <map>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
 
 #include "tubex_TubeVector.h"
 #include "tubex_TrajectoryVector.h"
@@ -26,15 +32,32 @@
 #include "tubex_CtcDynCid.h"
 #include "tubex_CtcDynCidGuess.h"
 #include "tubex_CtcDynBasic.h"
+#include "tubex_ThreadPool.h"
+#include "tubex_SliceArrays.h"
+#include "tubex_ContractionCache.h"
+#include "tubex_NodeStore.h"
+#include "tubex_DerivativeCache.h"
 
 using namespace std;
 namespace tubex
 {
+  /* result of one instance of a batch solving : the solution tubes and the statistics of its search */
+  struct SolverResult
+  {
+    std::list<TubeVector> solutions;
+    double solving_time = 0.;  // wall-clock time of the instance
+    int bisections = 0;
+  };
+
   class Solver
   {
   public:
 
       Solver(const ibex::Vector& max_thickness);
+      /* copy of the parameters only (no thread, no figure) */
+      Solver(const Solver& solver);
+      /* a solver owns its threads, caches and figure : no assignment */
+      Solver& operator=(const Solver&) = delete;
       ~Solver();
       /* Ratios used for stopping fixed point algorithms : all ratios are about the tube volume.
 	 For all these ratios, their possible values are :
@@ -61,26 +84,106 @@ namespace tubex
       2 randomly domain.ub() or domain.lb() */
       void set_var3b_timept(int var3b_timept); 
 
+      /* number of var3b times : 1 (default) : the time chosen by set_var3b_timept ;
+         k > 1 : the widest gates of k time windows of the same number of slices spread over the tdomain, 
+         shaved on copies of the tube in parallel (set_nb_threads) when the var3b contractions do not call
+         the external contraction, the results being intersected ; otherwise shaved sequentially */
+      void set_var3b_timepoints(int var3b_timepoints);
+
+      /* Shaving algorithm of var3b, on each side of the gate at the var3b time in each dimension
+      0 : geometric : slivers of increasing fraction (from 1% to 40%, x2) until one is not refuted ;
+      1 : adaptive : as 0, but each dimension and side starts at the last refuted fraction and the
+          dimensions and sides that repeatedly refute nothing are skipped during some calls ;
+      2 : dichotomic : binary search of the largest refuted fraction, up to the fraction the geometric shaving removes
+          when all its slivers are refuted (about 51%), with at most 6 trials per side */
+      void set_var3b_mode(int var3b_mode);
+
       /* Time choice for bisection 
       1 domain.ub(); 
       -1 domain.lb(); 
       0 max_diam_gate(); 
       2 randomly domain.ub() or domain.lb(); 
       3 round robin  domain.ub() and domain.lb() ; 
+      4 bisection guess : the largest gate whose midpoint is refuted by a slice contraction (cf bisection_guess),
+        bisected in the refuted dimension ; max_diam_gate() if no gate is refuted ;
       -2 no bisection */
       void set_bisection_timept (int bisection_timept); 
 
+      /* Bisection of the chosen gate component
+         arity : number of children (default 2) : the component is split into arity parts of the same diameter ;
+         ratio : position of the split point when arity is 2 and the contractions have not located a refuted point (default 0.49) ;
+         with the bisection time mode 4, the gate is split at the center of the interval refuted by the slice contractions
+         of bisection_guess, and the 2 children lose this interval ;
+         trial_contraction : each child is first contracted by CtcDeriv from the bisection time (when a derivative
+         function is given), and the refuted children are not kept (default false) */
+      void set_bisection_arity (int arity);
+      void set_bisection_ratio (float ratio);
+      void set_bisection_trial_contraction (bool trial_contraction);
+
+      /* nogoods : the decisions of the paths of the refuted nodes are stored (at most capacity, the oldest ones are forgotten).
+         A new node whose gates are inside all the decisions of a nogood is refuted without contraction ;
+         if they are inside all of them but one, its gate at the time of this decision is trimmed.
+         0 (default) : no nogood */
+      void set_nogood_capacity (int capacity);
+
+      /* cache of the first contraction of the initial tube, for repeated solvings of the same problem (cf ContractionCache) :
+         the initial tube is contracted by a cached enclosure when one applies, and its contraction is added to the cache otherwise.
+         The cache is owned by the caller ; NULL (default) : no cache */
+      void set_contraction_cache (ContractionCache* cache);
+
+      /* seed of the random choices of the bisection and var3b times : the generator is seeded at each node
+         by a hash of this seed and of the path of the node in the search tree, the choices do not depend on the search order */
+      void set_seed (unsigned int seed);
+
+      /* deterministic parallel search : the pending nodes are processed by waves of at most wave_width nodes taken
+         on top of the stack, the nodes of a wave being processed in parallel (set_nb_threads) by sequential copies of the solver.
+         The children and solutions of a wave are then gathered in the order of its nodes, so the solutions and the counters
+         do not depend on the number of threads. The state shared by the nodes (nogoods, global slice budget, 
+         adaptive var3b statistics) is not used in this mode. ctc_func must be reentrant.
+         0 (default) : sequential depth first search */
+      void set_deterministic_search (int wave_width);
+
+      /* compact pending nodes : the tubes of the nodes waiting on the search stack are kept without their codomains
+         (gates and slicing only, cf NodeStore). When a node is popped, its codomains are rebuilt from the initial tube 
+         and its first contraction is done on the whole tube instead of from the bisection time. Default false */
+      void set_compact_nodes (bool compact_nodes);
+
+      /* memory budget (in bytes) of the tubes of the pending nodes : beyond it, the tubes of the nodes at the bottom
+         of the search stack are written to a file named after spill_file, and read back when popped (cf NodeStore).
+         Each solving writes its own file (spill_file.<random number of the process>.<number>), so copies of the solver can spill concurrently.
+         0 (default) : no budget */
+      void set_node_memory_budget (long memory_budget, const std::string& spill_file = "tubex_nodes.spill");
+
       /* slicing limit :  no more refining when  max_slices is  reached */
       void set_max_slices(int max_slices); 
 
+      /* slice budget of a node at depth level : max_slices * depth_factor^level (depth_factor in ]0,1], default 1 : same budget at any depth),
+         except for the tubes thinner than twice the max thickness in every dimension, which keep max_slices to reach the precision.
+         The budget is also limited so that the slices of all the open nodes stay under max_open_slices (0, default : no global limit) */
+      void set_slice_budget_depth_factor(double depth_factor);
+      void set_max_open_slices(long max_open_slices);
+
+      /* coarsening : adjacent slices are merged when their union stays thinner than the max thickness
+         and increases their volume by less than coarsening_ratio (relative increase, in every dimension).
+         Done after each contraction following a refining and before a bisection.
+         -1 (default) : no coarsening */
+      void set_coarsening_ratio(double coarsening_ratio);
+
       /* refining mode : which slices to refine
          0 : all slices ; 
          1 : one slice (the steepest) ; 
          2 : the slices with a difference between input and output gates greater  than average ; 
-         3 : the slices with a difference between input and output gates greater  than the median.
+         3 : the slices with a difference between input and output gates greater  than the median ;
+         4 : the slices with a difference between input and output gates greater  than the quantile set by set_refining_quantile ;
+         5 : adaptive : the slices with the largest estimated gain of a split (codomain wider than the hull of its gates,
+             in thickness units, times the slice length), until 80% of the total estimated gain is covered.
       */
 
       void set_refining_mode(int refining_mode); 
+
+      /* quantile of the differences between input and output gates used as threshold by the refining mode 4,
+         in [0,1] : 0.9 (default) refines the 10% steepest slices, 0.5 is the median */
+      void set_refining_quantile(double refining_quantile);
  
       /* contraction mode : the ODE contractor called   
       0 for CtcDynBasic ;
@@ -103,6 +206,20 @@ namespace tubex
       */
       void set_trace(int trace);  
 
+      /* number of threads used by the parallel parts of the solver (calling thread included) ;
+       the evaluations of the derivative tube are also split into slice ranges evaluated by the threads
+       (a TFunction is copied once per thread, other TFnc must be reentrant ; an intertemporal function is evaluated sequentially)
+       1 : sequential (default)
+       0 : as many threads as cores */
+      void set_nb_threads(int nb_threads);
+
+      /* parallel-in-time ODE contraction : number of time segments 
+         1 : the whole tdomain is contracted as one tube (default)
+         K > 1 : the tdomain is split into K segments contracted in parallel, the gates shared by 
+         two segments are then intersected and the segments contracted again until a fixed point. 
+         Used for the ODE contraction outside var3b, when the derivative function is not intertemporal.*/
+      void set_time_segments(int time_segments);
+
      
       /* the solve method, it has for parameters a tube vector x0 , and 3 possibilities
          - a tube vector contractor ctc_func (for general problems as Integrodifferential problems and/or for using ctcVnode )
@@ -115,13 +232,34 @@ namespace tubex
       const std::list<TubeVector> solve(const TubeVector& x0, TFnc* f,void (*ctc_func)(TubeVector&, double t0, bool incremental));
       const std::list<TubeVector> solve(const TubeVector& x0, void (*ctc_func)(TubeVector&, double t0, bool incremental));
 
+      /* reentrant solve : the search state (counters, random generator, buffers, threads) belongs to the call,
+         the solver is only read and its solving_time and bisections are not modified : a configured solver 
+         can serve concurrent calls (with their own f when it is a TFunction, and a reentrant ctc_func).
+         The solutions are returned with the statistics of the call. */
+      const SolverResult solve_result(const TubeVector& x0, TFnc & f,void (*ctc_func)(TubeVector&, double t0, bool incremental)=NULL ) const;
+      const SolverResult solve_result(const TubeVector& x0, TFnc* f,void (*ctc_func)(TubeVector&, double t0, bool incremental)) const;
+      const SolverResult solve_result(const TubeVector& x0, void (*ctc_func)(TubeVector&, double t0, bool incremental)) const;
+
+      /* batch solving : the same problem (f and/or ctc_func) is solved from each initial tube vector of l_x0, 
+         the instances being scheduled on the threads of the solver (see set_nb_threads). 
+         The functions are shared by the threads : a TFunction is copied once per thread, other TFnc and ctc_func must be reentrant.
+         The i-th result corresponds to l_x0[i]. */
+      const std::vector<SolverResult> solve_batch(const std::vector<TubeVector>& l_x0, TFnc& f, void (*ctc_func)(TubeVector&, double t0, bool incremental)=NULL);
+      const std::vector<SolverResult> solve_batch(const std::vector<TubeVector>& l_x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental));
+      const std::vector<SolverResult> solve_batch(const std::vector<TubeVector>& l_x0, void (*ctc_func)(TubeVector&, double t0, bool incremental));
+
       VIBesFigTubeVector* figure();
       static const ibex::BoolInterval solutions_contain(const std::list<TubeVector>& l_solutions, const TrajectoryVector& truth);
       /* the solving time of a solve call */
       double solving_time;
 
+      /* mask of the slices of the tube being solved (one char per slice) created by the last refining : 
+         1 for the halves of a split slice, 0 for a slice left unchanged. 
+         Allows a contractor called after a refining to re-contract only the new slices. */
+      const vector<char>& newly_split_slices() const;
+
   protected:
-      double one_finite_gate(const TubeVector &x);
+      bool one_finite_gate(const TubeVector &x, double& t);
       bool empty_intersection(TubeVector& t1, TubeVector& t2);
       void clustering(std::list<std::pair<int,TubeVector> >& l_tubes);
       void clustering(std::list<TubeVector>& l_tubes);
@@ -132,28 +270,64 @@ namespace tubex
       double extreme_gates_sumofdiams (const TubeVector& x);
       bool fixed_point_reached(double volume_before, double volume_after, float fxpt_ratio);
 
-      void bisection (const TubeVector &x, list<pair<pair<int,double>,TubeVector> > &s, int level);
+      void process_node (SearchNode& node, const TubeVector& x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental),
+			 list<SearchNode>& s, list<TubeVector>& l_solutions);
+      void deterministic_search (list<SearchNode>& s, const TubeVector& x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental),
+				 list<TubeVector>& l_solutions);
+      static uint64_t path_hash (uint64_t parent, uint64_t child);
+      void bisection (TubeVector* x, list<SearchNode> &s, int level, TFnc* f, const std::shared_ptr<const Decision>& decisions);
+      void add_nogood (const std::shared_ptr<const Decision>& decisions);
+      void nogood_gates (const TubeVector& x);
+      ibex::IntervalVector& nogood_gate (double t);
+      bool nogood_refuted (TubeVector& x);
+      static bool is_bisectable(const Interval& gate);
+      static bool is_bisectable(const IntervalVector& gate);
+      bool try_split (TubeVector &x, double t, int dim, int arity, float ratio, vector<TubeVector*>& children);
+      float refuted_point_ratio (const ibex::Interval& gate, double point);
     
       void contraction_step(TubeVector &x, TFnc* f, void (*ctc_func)(TubeVector&,  double t0, bool incremental), bool incremental, double t0);
       void fixed_point_contraction (TubeVector &x, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental), float propa_fxpt_ratio, bool incremental, double t0, bool v3b=false);
       void contraction (TubeVector &x, TFnc * f,
 			void (*ctc_func) (TubeVector&,double t0,bool incremental),
 			bool incremental, double t0 , bool v3b);
-      void deriv_contraction (TubeVector &x, const TFnc& f, double t0, bool incremental );
-      void integration_contraction(TubeVector &x, const TFnc& f, double t0, bool incremental);
+      /* cached : the derivative tube is given by the derivative cache of the solver (not to be used by concurrent threads) */
+      void deriv_contraction (TubeVector &x, const TFnc& f, double t0, bool incremental, bool cached=true);
+      void integration_contraction(TubeVector &x, const TFnc& f, double t0, bool incremental, bool cached=true);
+      const TubeVector& derivative(TubeVector &x, const TFnc& f, bool cached, TubeVector*& v_eval);
       void picard_contraction (TubeVector &x, const TFnc& f);
+      void time_segments_contraction (TubeVector &x, TFnc& f);
+      ThreadPool* thread_pool();
+      const std::vector<TFnc*>& worker_fncs(TFnc& f);
+      const std::vector<Solver*>& worker_solvers();
+      void release_worker_fncs();
       void fixed_point_var3b(TubeVector &x, TFnc * f,void (*ctc_func) (TubeVector& ,double t0, bool incremental));
       void var3b(TubeVector &x,TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental));
+      void var3b_at(TubeVector &x,TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental), double t);
+      void var3b_times(const TubeVector &x, int nb_times, vector<double>& times);
+      void parallel_var3b(TubeVector &x,TFnc* f, const vector<double>& times);
+      double var3b_shave(TubeVector &x,TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental), int k, bool upper, double t, double rate);
+      double var3b_geometric_reach();
+      void var3b_dichotomic_shave(TubeVector &x,TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental), int k, bool upper, double t);
+      void var3b_adaptive_shave(TubeVector &x,TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental), int k, bool upper, double t);
 
-      bool refining (TubeVector &x);
+      void load_slices(const TubeVector &x);
+      bool refining (TubeVector &x, int level=0);
+      int slice_budget(const TubeVector &x, int level);
+      bool refining_by_mode (TubeVector &x);
+      int refine_slices(TubeVector& x, const vector<char>& split, int max_new_slices);
+      void compute_newly_split(const TubeVector& x);
       double average_refining_threshold(const TubeVector &x, vector<double>& slice_step);
       double median_refining_threshold(const TubeVector &x, vector<double>& slice_step);
+      double quantile_refining_threshold(const TubeVector &x, vector<double>& slice_step, double quantile);
       void refining_with_threshold(TubeVector & x);
       void refining_all_slices(TubeVector & x);
+      void refining_by_payoff(TubeVector & x);
+      void slice_payoffs(const TubeVector & x, vector<double>& payoff);
+      int coarsening(TubeVector & x, double t_kept);
 
-      void bisection_guess (TubeVector & x, TFnc& f);
-      std::pair<int,std::pair<double,double>> bisection_guess(TubeVector x, TubeVector v, DynCtc* slice_ctr, TFnc& fnc, int variant);
-      std::pair<int,std::pair<double,double>> bisection_guess(TubeVector x, TubeVector v, DynCtc* slice_ctr, TFnc& fnc);
+      std::pair<int,std::pair<double,double>> bisection_guess(TubeVector& x, TFnc& f, int variant);
+      std::pair<int,std::pair<double,double>> bisection_guess(TubeVector& x, TubeVector& v, DynCtc* slice_ctr, int variant);
+      std::pair<int,std::pair<double,double>> bisection_guess(TubeVector& x, TubeVector& v, DynCtc* slice_ctr);
       void print_solutions(const list<TubeVector> & l_solutions);
       void display_solutions(const list<TubeVector> & l_solutions);
     
@@ -167,19 +341,98 @@ namespace tubex
       float m_var3b_bisection_minrate = 0.01;
       float m_var3b_bisection_maxrate = 0.4;
       int m_var3b_bisection_ratefactor=2;
+      int m_var3b_mode=0;
+      int m_var3b_timepoints=1;
+      /* Internal parameter for the adaptive var3b : number of successive failures before skipping a dimension side */
+      int m_var3b_skip_threshold=3;
+      /* Internal parameter for the dichotomic var3b : number of trials per dimension side */
+      int m_var3b_dichotomy_trials=6;
+      /* Statistics of the adaptive var3b (index 2*k for the lower side of the dimension k, 2*k+1 for the upper side) :
+         fraction to start with, successive failures, calls still to skip */
+      vector<double> m_var3b_start_rate;
+      vector<int> m_var3b_failures;
+      vector<int> m_var3b_skip;
+      /* number of var3b trial contractions */
+      long m_var3b_trials=0;
       
       int m_var3b_timept=0;
       int m_bisection_timept=0;
+      int m_bisection_arity=2;
+      float m_bisection_ratio=0.49;
+      /* Internal parameter : a split ratio from a refuted point is kept in [min_ratio, 1-min_ratio] */
+      float m_bisection_min_ratio=0.05;
+      bool m_bisection_trial_contraction=false;
+      int m_nogood_capacity=0;
+      ContractionCache* m_contraction_cache=NULL;
+      unsigned int m_seed=1;
+      std::mt19937 m_rng;
+      uint64_t m_node_path=0;   // path of the node being processed
+      ibex::Interval m_guess_refuted;   // interval refuted around the bisection point of the last bisection_guess
+      int m_search_wave_width=0;
+      bool m_compact_nodes=false;
+      long m_node_memory_budget=0;
+      std::string m_spill_file;
+      NodeStore* m_node_store=NULL;   // during a solving with a memory budget
+      // derivative tube of the last ODE contraction, created on demand
+      DerivativeCache* m_derivative_cache=NULL;
+      /* refuted paths and number of nodes refuted or trimmed by them */
+      std::deque<std::shared_ptr<const Decision> > m_nogoods;
+      /* decision times of the nogoods with their number of decisions, and gates of the current node at these times */
+      std::map<double,int> m_nogood_times;
+      vector<double> m_nogood_gate_times;
+      vector<IntervalVector> m_nogood_gates;
+      int m_nogood_prunings=0;
+      int m_nogood_trimmings=0;
       int m_trace=0;
       int m_max_slices=5000;
+      double m_coarsening_ratio=-1;
+      double m_slice_budget_depth_factor=1.;
+      long m_max_open_slices=0;
+      /* Internal parameter of the slice budget : a tube thinner than ratio * max thickness keeps the whole max_slices budget */
+      double m_slice_budget_thin_ratio=2.;
       int m_refining_mode=0;
+      double m_refining_quantile=0.9;
+      /* Internal parameter for the refining mode 5 : share of the total estimated gain covered by the refined slices */
+      double m_refining_payoff_share=0.8;
       int m_contraction_mode=0; 
       int m_stopping_mode=0;
       bool m_var3b_external_contraction=true;
+      int m_nb_threads=1;
+      int m_time_segments=1;
+      /* Internal parameter for the time segments contraction : a shared gate is considered as contracted 
+         (and its segments contracted again) when its diameter is reduced by more than 1-ratio */
+      float m_time_segments_gate_ratio=0.999;
  
      
       /* number of bisections */
       int bisections=0; 
+      /* slices of the pending nodes of the search, and slice budget of the current node */
+      long m_open_slices=0;
+      int m_slice_budget=5000;
+
+      // Contiguous copy of the slices of the current tube, for the scans over all the slices
+      SliceArrays m_slices;
+      const TubeVector* m_slices_tube = NULL;   // the tube held by m_slices, NULL if it has been modified since
+
+      // Reused buffers of the refining thresholds : steps of the slices, finite steps for the selection of a quantile
+      vector<double> m_slice_step;
+      vector<double> m_finite_steps;
+      // Slicing before the last refining (upper bounds of the slices) and slices created by this refining
+      vector<double> m_slicing_ubs;
+      vector<char> m_newly_split;
+      vector<char> m_split;
+      vector<int> m_slice_order;
+      vector<double> m_removed_gates;
+      IntervalVector m_block_hull = IntervalVector(1);
+      vector<double> m_block_volume;
+      vector<Slice*> m_lockstep;
+
+      // Threads and per-thread copies of the derivative function, created on demand
+      ThreadPool *m_pool = NULL;
+      TFnc *m_worker_fncs_src = NULL;
+      std::vector<TFnc*> m_worker_fncs;
+      // Sequential copies of the solver used by the worker threads for the parallel var3b and the deterministic search
+      std::vector<Solver*> m_worker_solvers;
 
       // Embedded graphics
       VIBesFigTubeVector *m_fig = NULL;
@@ -23,25 +23,86 @@ using namespace ibex;
 
 namespace tubex
 {
-  void Solver::bisection_guess (TubeVector & x, TFnc& f){
-    TubeVector v = f.eval_vector(x);
-    CtcDynCid ctc(f);
-    std::pair< int,std::pair<double,double> > guess = bisection_guess (x,v,&ctc,f,2);
-    cout << " var " << guess.first << " time  " << guess.second.first << " point " << guess.second.second <<  endl;
-    if (guess.first >= 0 && x.size() > 1) {
-      cout << " var 0  " <<  *(x[0].first_slice()) <<  endl;
-      cout << 	*(x[0].last_slice()) << endl;
-      cout << " var 1 " <<  *(x[1].first_slice()) <<  endl;
-      cout << 	*(x[1].last_slice()) << endl;
+  /* bisection guess used by the bisection (bisection time mode 4) : the slice contractor of the contraction mode 
+     (CtcDynBasic for the modes 3 and 4) refutes the midpoints of the gates, the largest refuted gate is returned,
+     with the center of the refuted interval around its midpoint (m_guess_refuted).
+     The derivative tube comes from the derivative cache : the trials restore the slices of v they contract. */
+  std::pair<int,std::pair<double,double>> Solver::bisection_guess (TubeVector & x, TFnc& f, int variant){
+    TubeVector* v_eval = NULL;
+    TubeVector& v = const_cast<TubeVector&>(derivative(x, f, true, v_eval));
+    DynCtc* ctc;
+    if (m_contraction_mode==1)
+      ctc = new CtcDynCid(f);
+    else if (m_contraction_mode==2)
+      ctc = new CtcDynCidGuess(f);
+    else
+      ctc = new CtcDynBasic(f);
+    ctc->set_fast_mode(true);
+    std::pair< int,std::pair<double,double> > guess = bisection_guess (x,v,ctc,variant);
+    delete ctc;
+    delete v_eval;
+    return guess;
+  }
+
+  // slices of the trial : saving and restoring of the touched slices only
+  struct GuessSlice {
+    Interval codomain, input_gate, output_gate;
+  };
 
+  static void save_slices(const vector<Slice*>& slices, vector<GuessSlice>& saved){
+    for (size_t k = 0 ; k < slices.size() ; k++){
+      saved[k].codomain = slices[k]->codomain();
+      saved[k].input_gate = slices[k]->input_gate();
+      saved[k].output_gate = slices[k]->output_gate();
+    }
+  }
 
+  static void restore_slices(const vector<Slice*>& slices, const vector<GuessSlice>& saved){
+    for (size_t k = 0 ; k < slices.size() ; k++){
+      slices[k]->set_envelope(saved[k].codomain, false);
+      slices[k]->set_input_gate(saved[k].input_gate, false);
+      slices[k]->set_output_gate(saved[k].output_gate, false);
     }
-   
   }
 
-  
+  // contractor of the trials, dispatched once
+  struct GuessContractor {
+    CtcDynCid* cid;
+    CtcDynCidGuess* cidguess;
+    CtcDynBasic* basic;
+  };
+
+  /* trial of the value gate for the gate of the component i at the slices x_slice (output gates forward, input gates backward) :
+     true if the contraction of the slices empties one of them. The slices are restored. */
+  static bool refuted_trial(vector<Slice*>& x_slice, vector<Slice*>& v_slice, int i, const Interval& gate, TimePropag t_propa,
+			    const GuessContractor& ctc, vector<GuessSlice>& saved, vector<GuessSlice>& v_saved){
+    save_slices(x_slice, saved);
+    save_slices(v_slice, v_saved);
+    if (t_propa & TimePropag::FORWARD)
+      x_slice[i]->set_output_gate(gate);
+    else
+      x_slice[i]->set_input_gate(gate);
+    if (ctc.cid)
+      ctc.cid->contract(x_slice,v_slice,t_propa);
+    else if (ctc.cidguess)
+      ctc.cidguess->contract(x_slice,v_slice,t_propa);
+    else if (ctc.basic)
+      ctc.basic->contract(x_slice,v_slice,t_propa);
+
+    bool refuted = false;
+    for (size_t k = 0 ; k < x_slice.size() ; k++)
+      if (x_slice[k]->is_empty()) {refuted = true; break;}
+    restore_slices(x_slice, saved);
+    restore_slices(v_slice, v_saved);
+    return refuted;
+  }
 
-  std::pair<int,std::pair<double,double>> Solver::bisection_guess(TubeVector x, TubeVector v, DynCtc* slice_ctr, TFnc& fnc, int variant){
+  /* The midpoint of each gate is tried : the slices around the gate are contracted (by slice_ctr) 
+     and restored from their saved domains, x and v are unchanged at the end.
+     The refuted midpoint p of the returned gate [lb,ub] is then widened into a refuted interval m_guess_refuted : on each side,
+     the largest [p-d,p] (resp. [p,p+d]) refuted by the slice contraction is searched by dichotomy on d (at most 3 trials, 
+     d = p-lb first). The returned bisection point is the center of this interval. */
+  std::pair<int,std::pair<double,double>> Solver::bisection_guess(TubeVector& x, TubeVector& v, DynCtc* slice_ctr, int variant){
     //variant 0 -> return immediately as soon as we find a potential gate
 		//variant 1 -> return the largest gate in a slice
 		//variant 2 -> return the largest gate in the complete tube
@@ -60,21 +121,30 @@ namespace tubex
 		assert(x.tdomain() == v.tdomain());
 		assert(TubeVector::same_slicing(x, v));
 
-		/*init all the tubes*/
+		/*contractor dispatch, once*/
+		GuessContractor ctc;
+		ctc.cid = dynamic_cast <CtcDynCid*> (slice_ctr);
+		ctc.cidguess = ctc.cid ? NULL : dynamic_cast <CtcDynCidGuess*> (slice_ctr);
+		ctc.basic = (ctc.cid || ctc.cidguess) ? NULL : dynamic_cast <CtcDynBasic*> (slice_ctr);
+
 		vector<Slice*> x_slice;
 		vector<Slice*> v_slice;
-		/*auxiliar tubes*/
-		vector<Slice*> aux_x_slice; TubeVector aux_x = x;
-		vector<Slice*> aux_v_slice; TubeVector aux_v = v;
+		vector<GuessSlice> saved(x.size());
+		vector<GuessSlice> v_saved(v.size());
 
+		/*the slices and the gate of the returned bisection, for the widening of the refuted point*/
+		vector<Slice*> best_x_slice;
+		vector<Slice*> best_v_slice;
+		TimePropag best_propa = TimePropag::FORWARD;
+		Interval best_gate;
 
 		double max_diameter = -1;
 		double gate_diam;
-		for (int it = 0 ; it < 2 ; it++){
+		bool found = false;  // variants 0 and 1 : the search is over
+		for (int it = 0 ; it < 2 && !found ; it++){
 
 			/*push slices for forward phase*/
 			x_slice.clear(); v_slice.clear();
-			aux_x_slice.clear(); aux_v_slice.clear();
 
 			//for forward
 			TimePropag t_propa;
@@ -83,8 +153,6 @@ namespace tubex
 				for (int i = 0 ; i < x.size() ; i++){
 					x_slice.push_back(x[i].first_slice());
 					v_slice.push_back(v[i].first_slice());
-					aux_x_slice.push_back(aux_x[i].first_slice());
-					aux_v_slice.push_back(aux_v[i].first_slice());
 				}
 			}
 			//for backward
@@ -93,216 +161,88 @@ namespace tubex
 				for (int i = 0 ; i < x.size() ; i++){
 					x_slice.push_back(x[i].last_slice());
 					v_slice.push_back(v[i].last_slice());
-					aux_x_slice.push_back(aux_x[i].last_slice());
-					aux_v_slice.push_back(aux_v[i].last_slice());
 				}
 			}
 
-			while (x_slice[0] != NULL){
+			while (x_slice[0] != NULL && !found){
 				for (int i = 0 ; i < x.size() ; i++){
-				  if (t_propa & TimePropag::FORWARD){
-						x_bisection = aux_x_slice[i]->output_gate().mid();
-						t_bisection = aux_x_slice[i]->tdomain().ub();
-						gate_diam = aux_x_slice[i]->output_gate().diam();
-						aux_x_slice[i]->set_output_gate(x_bisection);
-					}
-				  else if (t_propa & TimePropag::BACKWARD){
-						x_bisection = aux_x_slice[i]->input_gate().mid();
-						t_bisection = aux_x_slice[i]->tdomain().lb();
-						gate_diam = aux_x_slice[i]->input_gate().diam();
-						aux_x_slice[i]->set_input_gate(x_bisection);
-					}
-					if(dynamic_cast <CtcDynCid*> (slice_ctr)){
-						CtcDynCid * cid = dynamic_cast <CtcDynCid*> (slice_ctr);
-						cid->contract(aux_x_slice,aux_v_slice,t_propa);
-					}
-
-					else if(dynamic_cast <CtcDynCidGuess*> (slice_ctr)){
-						CtcDynCidGuess * cidguess = dynamic_cast <CtcDynCidGuess*> (slice_ctr);
-						cidguess->contract(aux_x_slice,aux_v_slice,t_propa);
-					}
-					else if(dynamic_cast <CtcDynBasic*> (slice_ctr)){
-						CtcDynBasic * basic = dynamic_cast <CtcDynBasic*> (slice_ctr);
-						basic->contract(aux_x_slice,aux_v_slice,t_propa);
-					}
-
-					for (int k = 0 ; k < aux_x_slice.size() ; k++){
-						if (aux_x_slice[k]->is_empty()){
-							if (variant == 0){
-								bisection.first = i;
-								bisection.second.first = t_bisection;
-								bisection.second.second = x_bisection;
-								return bisection;
-							}
-							else {
-								if (gate_diam > max_diameter){
-									bisection.first = i;
-									bisection.second.first = t_bisection;
-									bisection.second.second = x_bisection;
-									max_diameter = gate_diam;
-									break;
-								}
-							}
-						}
-					}
-					//restore domains
-					for (int k = 0 ; k < aux_x_slice.size() ; k++){
-						aux_x_slice[k]->set_envelope(x_slice[k]->codomain());
-						aux_x_slice[k]->set_input_gate(x_slice[k]->input_gate());
-						aux_x_slice[k]->set_output_gate(x_slice[k]->output_gate());
+				  Interval gate = (t_propa & TimePropag::FORWARD) ? x_slice[i]->output_gate() : x_slice[i]->input_gate();
+				  if (!is_bisectable(gate) || gate.diam() >= DBL_MAX) continue;  // nothing to try
+				  x_bisection = gate.mid();
+				  gate_diam = gate.diam();
+				  if (t_propa & TimePropag::FORWARD)
+						t_bisection = x_slice[i]->tdomain().ub();
+				  else
+						t_bisection = x_slice[i]->tdomain().lb();
+
+					if (refuted_trial(x_slice, v_slice, i, Interval(x_bisection), t_propa, ctc, saved, v_saved)
+					    && (variant == 0 || gate_diam > max_diameter)){
+							bisection.first = i;
+							bisection.second.first = t_bisection;
+							bisection.second.second = x_bisection;
+							max_diameter = gate_diam;
+							best_x_slice = x_slice;
+							best_v_slice = v_slice;
+							best_propa = t_propa;
+							best_gate = gate;
+							if (variant == 0) {found = true; break;}
 					}
 				}
 
-				if (variant == 1){
-					if (bisection.first != -1)
-						return bisection;
-				}
+				if (variant == 1 && bisection.first != -1)
+					found = true;
+				if (found) break;
 
 				if (t_propa & TimePropag::FORWARD){
 					for (int i = 0 ; i < x.size() ; i++){
 						x_slice[i] = x_slice[i]->next_slice();
 						v_slice[i] = v_slice[i]->next_slice();
-						aux_x_slice[i] = aux_x_slice[i]->next_slice();
-						aux_v_slice[i] = aux_v_slice[i]->next_slice();
 					}
 				}
 				else if (t_propa & TimePropag::BACKWARD){
 					for (int i = 0 ; i < x.size() ; i++){
 						x_slice[i] = x_slice[i]->prev_slice();
 						v_slice[i] = v_slice[i]->prev_slice();
-						aux_x_slice[i] = aux_x_slice[i]->prev_slice();
-						aux_v_slice[i] = aux_v_slice[i]->prev_slice();
 					}
 				}
 			}
 		}
-		/*if variant 2 is selected, it will return here*/
-		return bisection;
-	}
-
-
-
-
-
-  std::pair<int,std::pair<double,double>> Solver::bisection_guess(TubeVector x, TubeVector v, DynCtc* slice_ctr, TFnc& fnc){
-
-		/*variable - time of bisection - bisection point*/
-		pair <int, pair <double,double> > bisection;
-
-		double t_bisection;  //time of bisection (in t)
-		double x_bisection; // value of bisection (in x)
-
-		/*init pair*/
-		bisection = make_pair(-1,make_pair(-1,-1));
-
-		/*check if everything is ok*/
-		assert(x.size() == v.size());
-		assert(x.tdomain() == v.tdomain());
-		assert(TubeVector::same_slicing(x, v));
-
-
-
-		/*init all the tubes*/
-		vector<Slice*> x_slice;
-		vector<Slice*> v_slice;
-		/*auxiliar tubes*/
-		vector<Slice*> aux_x_slice; TubeVector aux_x = x;
-		vector<Slice*> aux_v_slice; TubeVector aux_v = v;
-
-
-		for (int it = 0 ; it < 2 ; it++){
-
-			/*push slices for forward phase*/
-			x_slice.clear(); v_slice.clear();
-			aux_x_slice.clear(); aux_v_slice.clear();
 
-			//for forward
-			TimePropag t_propa;
-			if (it == 0){
-			  t_propa = TimePropag::FORWARD;
-				for (int i = 0 ; i < x.size() ; i++){
-					x_slice.push_back(x[i].first_slice());
-					v_slice.push_back(v[i].first_slice());
-					aux_x_slice.push_back(aux_x[i].first_slice());
-					aux_v_slice.push_back(aux_v[i].first_slice());
-				}
-			}
-			//for backward
-			else{
-			  t_propa = TimePropag::BACKWARD;
-				for (int i = 0 ; i < x.size() ; i++){
-					x_slice.push_back(x[i].last_slice());
-					v_slice.push_back(v[i].last_slice());
-					aux_x_slice.push_back(aux_x[i].last_slice());
-					aux_v_slice.push_back(aux_v[i].last_slice());
+		if (bisection.first == -1) return bisection;
+
+		/*widening of the refuted point*/
+		int i = bisection.first;
+		double p = bisection.second.second;
+		double refuted_lb = p, refuted_ub = p;
+		for (int side = 0 ; side < 2 ; side++){
+			double d_max = (side == 0) ? p - best_gate.lb() : best_gate.ub() - p;
+			double d_ok = 0., d_ko = d_max;   // refuted width, not refuted width (above d_max : outside the gate)
+			double d = d_max;
+			for (int trial = 0 ; trial < 3 ; trial++){
+				Interval part = (side == 0) ? Interval(p - d, p) : Interval(p, p + d);
+				if (refuted_trial(best_x_slice, best_v_slice, i, part, best_propa, ctc, saved, v_saved)){
+					d_ok = d;
+					if (d == d_max) break;
 				}
+				else
+					d_ko = d;
+				d = 0.5 * (d_ok + d_ko);
 			}
+			if (side == 0) refuted_lb = p - d_ok;
+			else refuted_ub = p + d_ok;
+		}
+		m_guess_refuted = Interval(refuted_lb, refuted_ub);
+		bisection.second.second = m_guess_refuted.mid();
+		return bisection;
+	}
 
-			while (x_slice[0] != NULL){
-				for (int i = 0 ; i < x.size() ; i++){
-				  if (t_propa & TimePropag::FORWARD){
-						x_bisection = aux_x_slice[i]->output_gate().mid();
-						t_bisection = aux_x_slice[i]->tdomain().ub();
-						aux_x_slice[i]->set_output_gate(x_bisection);
-					}
-				  else if (t_propa & TimePropag::BACKWARD){
-						x_bisection = aux_x_slice[i]->input_gate().mid();
-						t_bisection = aux_x_slice[i]->tdomain().lb();
-						aux_x_slice[i]->set_input_gate(x_bisection);
-					}
-					if(dynamic_cast <CtcDynCid*> (slice_ctr)){
-						CtcDynCid * cid = dynamic_cast <CtcDynCid*> (slice_ctr);
-						cid->contract(aux_x_slice,aux_v_slice,t_propa);
-					}
-
-					else if(dynamic_cast <CtcDynCidGuess*> (slice_ctr)){
-						CtcDynCidGuess * cidguess = dynamic_cast <CtcDynCidGuess*> (slice_ctr);
-						cidguess->contract(aux_x_slice,aux_v_slice,t_propa);
-
-					}
-					else if(dynamic_cast <CtcDynBasic*> (slice_ctr)){
-						CtcDynBasic * basic = dynamic_cast <CtcDynBasic*> (slice_ctr);
-						basic->contract(aux_x_slice,aux_v_slice,t_propa);
 
-					}
 
-					for (int i = 0 ; i < aux_x_slice.size() ; i++){
-						if (aux_x_slice[i]->is_empty()){
-							bisection.first = i;
-							bisection.second.first = t_bisection;
-							bisection.second.second = x_bisection;
-							return bisection;
-						}
-					}
-					//restore domains
-					for (int i = 0 ; i < aux_x_slice.size() ; i++){
-						aux_x_slice[i]->set_envelope(x_slice[i]->codomain());
-						aux_x_slice[i]->set_input_gate(x_slice[i]->input_gate());
-						aux_x_slice[i]->set_output_gate(x_slice[i]->output_gate());
-					}
 
-				}
 
-				if (t_propa & TimePropag::FORWARD){
-					for (int i = 0 ; i < x.size() ; i++){
-						x_slice[i] = x_slice[i]->next_slice();
-						v_slice[i] = v_slice[i]->next_slice();
-						aux_x_slice[i] = aux_x_slice[i]->next_slice();
-						aux_v_slice[i] = aux_v_slice[i]->next_slice();
-					}
-				}
-				else if (t_propa & TimePropag::BACKWARD){
-					for (int i = 0 ; i < x.size() ; i++){
-						x_slice[i] = x_slice[i]->prev_slice();
-						v_slice[i] = v_slice[i]->prev_slice();
-						aux_x_slice[i] = aux_x_slice[i]->prev_slice();
-						aux_v_slice[i] = aux_v_slice[i]->prev_slice();
-					}
-				}
-			}
-		}
-		/*there is not candidate to bisect (to check, the variable is -1)*/
-		return bisection;
+  std::pair<int,std::pair<double,double>> Solver::bisection_guess(TubeVector& x, TubeVector& v, DynCtc* slice_ctr){
+		/*the first refuted gate : variant 0*/
+		return bisection_guess(x, v, slice_ctr, 0);
 	}
 
 
@@ -0,0 +1,397 @@
+/* ============================================================================
+ *  tubex-lib - Parallel contractions (part of Solver)
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+
+#include <chrono>
+#include "tubex_Solver.h"
+#include "tubex_TFunction.h"
+
+
+
+using namespace std;
+using namespace ibex;
+
+namespace tubex
+{
+  ThreadPool* Solver::thread_pool()
+  {
+    if (!m_pool)
+      m_pool = new ThreadPool(m_nb_threads);
+    return m_pool;
+  }
+
+  /* One derivative function per thread : an ibex function is not reentrant (its evaluation
+     uses internal buffers), so each worker thread evaluates its own copy of a TFunction.
+     Other TFnc are shared and must be reentrant. The worker 0 (calling thread) uses f itself. */
+  const vector<TFnc*>& Solver::worker_fncs(TFnc& f)
+  {
+    int nb_workers = thread_pool()->nb_threads();
+    if (m_worker_fncs_src != &f || (int)m_worker_fncs.size() != nb_workers)
+      {
+	release_worker_fncs();
+	m_worker_fncs_src = &f;
+	m_worker_fncs.assign(nb_workers, &f);
+	TFunction* tf = dynamic_cast<TFunction*> (&f);
+	if (tf)
+	  for (int w = 1; w < nb_workers; w++)
+	    m_worker_fncs[w] = new TFunction(*tf);
+      }
+    return m_worker_fncs;
+  }
+
+  /* Sequential copies of the solver (parameters only), one per worker thread */
+  const vector<Solver*>& Solver::worker_solvers()
+  {
+    int nb_workers = thread_pool()->nb_threads();
+    if ((int)m_worker_solvers.size() != nb_workers)
+      {
+	for (size_t w = 0; w < m_worker_solvers.size(); w++) delete m_worker_solvers[w];
+	m_worker_solvers.assign(nb_workers, NULL);
+	for (int w = 0; w < nb_workers; w++)
+	  {
+	    m_worker_solvers[w] = new Solver(*this);
+	    m_worker_solvers[w]->m_nb_threads = 1;
+	    m_worker_solvers[w]->m_trace = 0;   // no interleaved traces
+	    m_worker_solvers[w]->m_var3b_trials = 0;
+	    m_worker_solvers[w]->bisections = 0;
+	  }
+      }
+    return m_worker_solvers;
+  }
+
+  void Solver::release_worker_fncs()
+  {
+    for (size_t w = 0; w < m_worker_fncs.size(); w++)
+      if (m_worker_fncs[w] != m_worker_fncs_src) delete m_worker_fncs[w];
+    m_worker_fncs.clear();
+    m_worker_fncs_src = NULL;
+    for (size_t w = 0; w < m_worker_solvers.size(); w++)
+      delete m_worker_solvers[w];
+    m_worker_solvers.clear();
+  }
+
+  //  ------------------------------------------------------BATCH SOLVING----------------------------------------------
+
+  const vector<SolverResult> Solver::solve_batch(const vector<TubeVector>& l_x0, TFnc& f, void (*ctc_func)(TubeVector&, double t0, bool incremental)) { return (solve_batch(l_x0,&f,ctc_func));}
+
+  const vector<SolverResult> Solver::solve_batch(const vector<TubeVector>& l_x0, void (*ctc_func)(TubeVector&, double t0, bool incremental)) { return (solve_batch(l_x0,NULL,ctc_func));}
+
+  /* Each worker thread solves its instances with its own sequential copy of the solver (parameters only)
+     and its own copy of f (see worker_fncs) ; the instances are taken in order by the first idle worker. */
+  const vector<SolverResult> Solver::solve_batch(const vector<TubeVector>& l_x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental))
+  {
+    vector<SolverResult> results(l_x0.size());
+    chrono::steady_clock::time_point t_start = chrono::steady_clock::now();
+
+    ThreadPool* pool = thread_pool();
+    vector<TFnc*> fncs(pool->nb_threads(), f);
+    if (f) fncs = worker_fncs(*f);
+    vector<Solver*> solvers(pool->nb_threads(), NULL);
+    for (size_t w = 0; w < solvers.size(); w++)
+      {
+	solvers[w] = new Solver(*this);
+	solvers[w]->m_nb_threads = 1;
+	solvers[w]->m_trace = 0;   // no interleaved traces
+      }
+
+    try
+      {
+	pool->run(l_x0.size(), [&](int k, int worker)
+	  {
+	    Solver* solver = solvers[worker];
+	    results[k].solutions = solver->solve(l_x0[k], fncs[worker], ctc_func);
+	    results[k].solving_time = solver->solving_time;
+	    results[k].bisections = solver->bisections;
+	  });
+      }
+    catch (...)
+      {
+	for (size_t w = 0; w < solvers.size(); w++) delete solvers[w];
+	release_worker_fncs();
+	throw;
+      }
+
+    for (size_t w = 0; w < solvers.size(); w++) delete solvers[w];
+    release_worker_fncs();
+    solving_time = chrono::duration<double>(chrono::steady_clock::now() - t_start).count();
+
+    if (m_trace)
+      {
+	for (size_t k = 0; k < results.size(); k++)
+	  cout << "instance " << k+1 << " : " << results[k].solutions.size() << " solution(s), " 
+	       << results[k].bisections << " bisections, time " << results[k].solving_time << endl;
+	cout << "Batch solving time " << solving_time << endl;
+      }
+    return results;
+  }
+
+  //  ------------------------------------------------------MULTI-TIME VAR3B----------------------------------------------
+
+  /* The shavings at the different times are independent : each one is done on its own copy of x by a worker thread,
+     with its own sequential copy of the solver (the adaptive var3b statistics are then per thread), 
+     and x is contracted to the intersection of the results. */
+  void Solver::parallel_var3b(TubeVector &x, TFnc* f, const vector<double>& times)
+  {
+    ThreadPool* pool = thread_pool();
+    const vector<TFnc*>& fncs = worker_fncs(*f);
+    const vector<Solver*>& solvers = worker_solvers();
+
+    vector<TubeVector*> results(times.size(), NULL);
+    try
+      {
+	pool->run(times.size(), [&](int j, int worker)
+	  {
+	    Solver* solver = solvers[worker];
+	    results[j] = new TubeVector(x);
+	    solver->var3b_at(*results[j], fncs[worker], NULL, times[j]);  // no external contraction in var3b
+	  });
+      }
+    catch (...)
+      {
+	for (size_t j = 0; j < results.size(); j++) delete results[j];
+	throw;
+      }
+
+    for (size_t j = 0; j < results.size(); j++)
+      {
+	x &= *results[j];
+	delete results[j];
+      }
+    m_slices_tube = NULL;
+    for (size_t w = 0; w < solvers.size(); w++)
+      {
+	m_var3b_trials += solvers[w]->m_var3b_trials;
+	solvers[w]->m_var3b_trials = 0;
+      }
+  }
+
+  //  ------------------------------------------------------DETERMINISTIC SEARCH----------------------------------------------
+
+  /* The nodes of a wave are taken on top of the stack and processed in parallel, each one by the sequential solver copy
+     of its worker thread (per-thread derivative function, see worker_fncs). Each node writes its children and its solution
+     in its own lists, which are gathered in the order of the wave : the children of the first node stay on top of the stack.
+     The processing of a node only depends on the node itself (its random choices are seeded by its path), so the search tree,
+     the solutions and the counters are the same for any number of threads. */
+  void Solver::deterministic_search(list<SearchNode>& s, const TubeVector& x0, TFnc* f, void (*ctc_func)(TubeVector&, double t0, bool incremental),
+				    list<TubeVector>& l_solutions)
+  {
+    ThreadPool* pool = thread_pool();
+    vector<TFnc*> fncs(pool->nb_threads(), f);
+    if (f) fncs = worker_fncs(*f);
+    const vector<Solver*>& solvers = worker_solvers();
+    for (size_t w = 0; w < solvers.size(); w++)
+      { // no state shared between the nodes
+	solvers[w]->m_nogood_capacity = 0;
+	solvers[w]->m_nogoods.clear();
+	solvers[w]->m_nogood_times.clear();
+	solvers[w]->m_max_open_slices = 0;
+	if (solvers[w]->m_var3b_mode == 1) solvers[w]->m_var3b_mode = 0;
+      }
+
+    vector<SearchNode> wave;
+    vector<list<SearchNode> > children;
+    vector<list<TubeVector> > solutions;
+    while (!s.empty())
+      {
+	wave.clear();
+	while (!s.empty() && (int)wave.size() < m_search_wave_width)
+	  {
+	    wave.push_back(s.front());
+	    s.pop_front();
+	    if (m_node_store) m_node_store->reload(wave.back());
+	  }
+	children.assign(wave.size(), list<SearchNode>());
+	solutions.assign(wave.size(), list<TubeVector>());
+
+	try
+	  {
+	    pool->run(wave.size(), [&](int k, int worker)
+	      {
+		solvers[worker]->process_node(wave[k], x0, fncs[worker], ctc_func, children[k], solutions[k]);
+	      });
+	  }
+	catch (...)
+	  { // the tubes of the wave (NULL once deleted or reused by a child) and of their children ; s is released by solve
+	    for (size_t k = 0; k < wave.size(); k++)
+	      NodeStore::release(children[k], &wave[k]);
+	    throw;
+	  }
+
+	for (int k = wave.size()-1; k >= 0; k--)
+	  s.splice(s.begin(), children[k]);
+	for (size_t k = 0; k < solutions.size(); k++)
+	  l_solutions.splice(l_solutions.end(), solutions[k]);
+	if (m_compact_nodes) NodeStore::compact(s, m_search_wave_width);   // the next wave stays expanded
+	if (m_node_store) m_node_store->spill(s);
+      }
+
+    for (size_t w = 0; w < solvers.size(); w++)
+      {
+	bisections += solvers[w]->bisections;
+	m_var3b_trials += solvers[w]->m_var3b_trials;
+	solvers[w]->bisections = 0;
+	solvers[w]->m_var3b_trials = 0;
+      }
+  }
+
+  //  ------------------------------------------------------TIME SEGMENTS----------------------------------------------
+
+  // copies into seg (a one slice tube on the segment tdomain) the nb_slices slices of x beginning at first[i] in each dimension
+  static void copy_segment(const vector<Slice*>& first, int nb_slices, TubeVector& seg)
+  {
+    for (int i = 0; i < seg.size(); i++)
+      {
+	Slice* dst = seg[i].first_slice();
+	const Slice* src = first[i];
+	for (int j = 0; j < nb_slices; j++, src = src->next_slice())
+	  {
+	    if (j < nb_slices-1)
+	      seg[i].sample(src->tdomain().ub(), dst);
+	    dst->set_envelope(src->codomain(), false);
+	    dst->set_input_gate(src->input_gate(), false);
+	    dst->set_output_gate(src->output_gate(), false);
+	    dst = dst->next_slice();
+	  }
+      }
+  }
+
+  // a shared gate g has been contracted enough w.r.t. the gate ref obtained by a segment to contract this segment again
+  static bool gate_contracted(const Interval& ref, const Interval& g, float ratio)
+  {
+    return g.diam() < ratio * ref.diam();
+  }
+
+  /* Parallel-in-time ODE contraction : the tdomain is split into m_time_segments segments (at most one per slice) of the same number of slices.
+     Each segment is copied and contracted by the ODE contractor on its own thread, x being only read by the threads ;
+     the codomains and inner gates of the segments are then copied back sequentially (the setters of a slice update its tube).
+     The gates shared by two segments are then intersected, and the segments whose boundary gates have been contracted
+     are contracted again, until a fixed point is reached. */
+  void Solver::time_segments_contraction(TubeVector &x, TFnc& f)
+  {
+    int n = x.size();
+    int nb_slices = x.nb_slices();
+    int nb_segments = min(m_time_segments, nb_slices);   // at least one slice per segment
+
+    // first slice of each segment in each dimension
+    vector<vector<Slice*> > first(nb_segments, vector<Slice*>(n));
+    vector<int> seg_slices(nb_segments);
+    for (int k = 0; k < nb_segments; k++)
+      seg_slices[k] = (int)((long)(k+1)*nb_slices/nb_segments - (long)k*nb_slices/nb_segments);
+    for (int i = 0; i < n; i++)
+      {
+	int k = 0; int id = 0; int next_first = 0;
+	for (Slice* s = x[i].first_slice(); s != NULL && k < nb_segments; s = s->next_slice(), id++)
+	  if (id == next_first)
+	    {
+	      first[k][i] = s;
+	      next_first += seg_slices[k];
+	      k++;
+	    }
+      }
+
+    ThreadPool* pool = thread_pool();
+    const vector<TFnc*>& fncs = worker_fncs(f);
+
+    // written by one task each : char instead of bool for concurrent writes
+    vector<unique_ptr<TubeVector> > segs(nb_segments);   // contracted segments, copied back after the threads
+    vector<char> active(nb_segments, 1);
+    vector<char> empty(nb_segments, 0);
+    vector<char> resliced(nb_segments, 0);
+    vector<IntervalVector> in_gates(nb_segments, IntervalVector(n));
+    vector<IntervalVector> out_gates(nb_segments, IntervalVector(n));
+
+    bool contracted = true;
+    while (contracted)
+      {
+	pool->run(nb_segments, [&](int k, int worker)
+	  {
+	    if (!active[k]) return;
+	    const Slice* last = first[k][0];
+	    for (int j = 1; j < seg_slices[k]; j++) last = last->next_slice();
+	    segs[k].reset(new TubeVector(Interval(first[k][0]->tdomain().lb(), last->tdomain().ub()), n));
+	    TubeVector& seg = *segs[k];
+	    copy_segment(first[k], seg_slices[k], seg);
+
+	    if (m_contraction_mode==4){
+	      picard_contraction(seg, *fncs[worker]);
+	      deriv_contraction(seg, *fncs[worker], seg.tdomain().lb(), false, false);  // no shared derivative cache
+	    }
+	    else if (m_contraction_mode <=2)
+	      integration_contraction(seg, *fncs[worker], seg.tdomain().lb(), false, false);
+
+	    if (seg.is_empty()) empty[k] = 1;
+	    else if (seg.nb_slices() != seg_slices[k]) resliced[k] = 1; // result not copied back
+	  });
+
+	bool is_empty = false;
+	for (int k = 0; k < nb_segments; k++)
+	  {
+	    if (empty[k]) is_empty = true;
+	    if (segs[k] && !empty[k] && !resliced[k])
+	      // the inner gates and the codomains belong to this segment only
+	      for (int i = 0; i < n; i++)
+		{
+		  const TubeVector& seg = *segs[k];
+		  const Slice* src = seg[i].first_slice();
+		  Slice* dst = first[k][i];
+		  for (int j = 0; j < seg_slices[k]; j++, src = src->next_slice(), dst = dst->next_slice())
+		    {
+		      dst->set_envelope(src->codomain(), false);
+		      if (j < seg_slices[k]-1)
+			dst->set_output_gate(src->output_gate(), false);
+		    }
+		  in_gates[k][i] = seg[i].first_slice()->input_gate();
+		  out_gates[k][i] = seg[i].last_slice()->output_gate();
+		}
+	    segs[k].reset();
+	  }
+	if (is_empty) { x.set_empty(); return; }
+
+	// gates shared by the segments k-1 and k (gate 0 : tdomain lb, gate nb_segments : tdomain ub)
+	contracted = false;
+	vector<char> next_active(nb_segments, 0);
+	for (int k = 0; k <= nb_segments; k++)
+	  for (int i = 0; i < n; i++)
+	    {
+	      Interval g = (k < nb_segments) ? first[k][i]->input_gate() : x[i].last_slice()->output_gate();
+	      if (k > 0 && !resliced[k-1]) g &= out_gates[k-1][i];
+	      if (k < nb_segments && !resliced[k]) g &= in_gates[k][i];
+	      if (g.is_empty()) { x.set_empty(); return; }
+
+	      if (k > 0 && !resliced[k-1] && gate_contracted(out_gates[k-1][i], g, m_time_segments_gate_ratio))
+		{ next_active[k-1] = 1; contracted = true; }
+	      if (k < nb_segments && !resliced[k] && gate_contracted(in_gates[k][i], g, m_time_segments_gate_ratio))
+		{ next_active[k] = 1; contracted = true; }
+
+	      if (k < nb_segments)
+		first[k][i]->set_input_gate(g, false);
+	      else
+		x[i].last_slice()->set_output_gate(g, false);
+	      if (k > 0 && !resliced[k-1]) out_gates[k-1][i] = g;
+	      if (k < nb_segments && !resliced[k]) in_gates[k][i] = g;
+	    }
+	active = next_active;
+      }
+
+    bool fallback = false;
+    for (int k = 0; k < nb_segments; k++)
+      if (resliced[k]) fallback = true;
+    if (fallback){ // a contractor changed the slicing of a segment : sequential contraction of the whole tube
+      if (m_contraction_mode==4){
+	picard_contraction(x,f);
+	deriv_contraction(x,f, x.tdomain().lb(), false);
+      }
+      else if (m_contraction_mode <=2)
+	integration_contraction(x,f, x.tdomain().lb(), false);
+    }
+  }
+}
@@ -0,0 +1,316 @@
+/* ============================================================================
+ *  tubex-lib - TFunctionBatch class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+/* This file must be compiled with -frounding-math (cf CMakeLists.txt) : the computations depend on the rounding mode */
+
+#include <cassert>
+#include <cfenv>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "tubex_TFunctionBatch.h"
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace ibex;
+
+namespace tubex
+{
+  TFunctionBatch::TFunctionBatch(const TFunction& f)
+  {
+    const Function& fn = f.getFunction();
+    m_nb_arg = fn.nb_arg();
+    if (m_nb_arg != f.nb_var() + 1)  // t and the variables
+      m_compiled = false;
+    for (int j = 0; j < m_nb_arg && m_compiled; j++)
+      {
+	if (!fn.arg(j).dim.is_scalar()) m_compiled = false;
+	m_regs[&fn.arg(j)] = j;
+      }
+
+    const ExprVector* y = dynamic_cast<const ExprVector*>(&fn.expr());
+    if (y)
+      for (int i = 0; i < y->nb_args && m_compiled; i++)
+	m_outputs.push_back(compile(y->arg(i)));
+    else if (m_compiled)
+      m_outputs.push_back(compile(fn.expr()));
+    m_nb_regs = m_nb_arg + m_tape.size();
+    m_regs.clear();
+  }
+
+  bool TFunctionBatch::is_compiled() const
+  {
+    return m_compiled;
+  }
+
+  int TFunctionBatch::nb_arg() const
+  {
+    return m_nb_arg;
+  }
+
+  int TFunctionBatch::image_dim() const
+  {
+    return m_outputs.size();
+  }
+
+  // register of the value of e (a shared subexpression is compiled once)
+  int TFunctionBatch::compile(const ExprNode& e)
+  {
+    map<const ExprNode*, int>::const_iterator it = m_regs.find(&e);
+    if (it != m_regs.end()) return it->second;
+    if (!m_compiled || !e.dim.is_scalar()) { m_compiled = false; return 0; }
+
+    Instruction ins = {CONST, 0, 0, 0., 0.};
+    if (const ExprConstant* c = dynamic_cast<const ExprConstant*>(&e))
+      {
+	ins.lb = c->get_value().lb();
+	ins.ub = c->get_value().ub();
+      }
+    else if (const ExprAdd* add = dynamic_cast<const ExprAdd*>(&e))
+      {
+	ins.op = ADD; ins.a = compile(add->left); ins.b = compile(add->right);
+      }
+    else if (const ExprSub* sub = dynamic_cast<const ExprSub*>(&e))
+      {
+	ins.op = SUB; ins.a = compile(sub->left); ins.b = compile(sub->right);
+      }
+    else if (const ExprMul* mul = dynamic_cast<const ExprMul*>(&e))
+      {
+	ins.op = MUL; ins.a = compile(mul->left); ins.b = compile(mul->right);
+      }
+    else if (const ExprMinus* minus = dynamic_cast<const ExprMinus*>(&e))
+      {
+	ins.op = MINUS; ins.a = compile(minus->expr);
+      }
+    else if (const ExprSqr* sqr = dynamic_cast<const ExprSqr*>(&e))
+      {
+	ins.op = SQR; ins.a = compile(sqr->expr);
+      }
+    else if (const ExprPower* power = dynamic_cast<const ExprPower*>(&e))
+      {
+	if (power->expon == 1)
+	  return compile(power->expr);
+	if (power->expon != 2) { m_compiled = false; return 0; }
+	ins.op = SQR; ins.a = compile(power->expr);
+      }
+    else
+      {
+	m_compiled = false;
+	return 0;
+      }
+
+    if (!m_compiled) return 0;
+    m_tape.push_back(ins);
+    int r = m_nb_arg + m_tape.size() - 1;
+    m_regs[&e] = r;
+    return r;
+  }
+
+  // ------------------------------------------------------ KERNELS ------------------------------------------------------
+  /* The rounding mode is upward : ub is computed directly, lb as -(upward computation of -lb).
+     With finite arguments (the boxes with an infinite bound are not valid, see eval), an infinite bound can only come
+     from an overflow rounded upward : an upper bound is never -inf and a lower bound never +inf, so inf-inf does not occur ;
+     0*inf (NaN) counts as 0, as in the interval product. */
+
+#if defined(__AVX2__)
+  static inline __m256d neg(__m256d x)
+  {
+    return _mm256_xor_pd(x, _mm256_set1_pd(-0.));
+  }
+
+  static inline __m256d nan_to_zero(__m256d x)
+  {
+    return _mm256_andnot_pd(_mm256_cmp_pd(x, x, _CMP_UNORD_Q), x);
+  }
+
+  static inline __m256d max4(__m256d p1, __m256d p2, __m256d p3, __m256d p4)
+  {
+    return _mm256_max_pd(_mm256_max_pd(nan_to_zero(p1), nan_to_zero(p2)), _mm256_max_pd(nan_to_zero(p3), nan_to_zero(p4)));
+  }
+#endif
+
+  static inline double nan_to_zero(double x)
+  {
+    return (x != x) ? 0. : x;
+  }
+
+  static inline double max4(double p1, double p2, double p3, double p4)
+  {
+    return max(max(nan_to_zero(p1), nan_to_zero(p2)), max(nan_to_zero(p3), nan_to_zero(p4)));
+  }
+
+  static void add(int n, const double* al, const double* au, const double* bl, const double* bu, double* rl, double* ru)
+  {
+    int k = 0;
+#if defined(__AVX2__)
+    for (; k + 4 <= n; k += 4)
+      {
+	__m256d nal = neg(_mm256_loadu_pd(al + k));
+	_mm256_storeu_pd(rl + k, neg(_mm256_sub_pd(nal, _mm256_loadu_pd(bl + k))));
+	_mm256_storeu_pd(ru + k, _mm256_add_pd(_mm256_loadu_pd(au + k), _mm256_loadu_pd(bu + k)));
+      }
+#endif
+    for (; k < n; k++)
+      {
+	rl[k] = -((-al[k]) - bl[k]);
+	ru[k] = au[k] + bu[k];
+      }
+  }
+
+  static void sub(int n, const double* al, const double* au, const double* bl, const double* bu, double* rl, double* ru)
+  {
+    int k = 0;
+#if defined(__AVX2__)
+    for (; k + 4 <= n; k += 4)
+      {
+	_mm256_storeu_pd(rl + k, neg(_mm256_sub_pd(_mm256_loadu_pd(bu + k), _mm256_loadu_pd(al + k))));
+	_mm256_storeu_pd(ru + k, _mm256_sub_pd(_mm256_loadu_pd(au + k), _mm256_loadu_pd(bl + k)));
+      }
+#endif
+    for (; k < n; k++)
+      {
+	rl[k] = -(bu[k] - al[k]);
+	ru[k] = au[k] - bl[k];
+      }
+  }
+
+  static void mul(int n, const double* al, const double* au, const double* bl, const double* bu, double* rl, double* ru)
+  {
+    int k = 0;
+#if defined(__AVX2__)
+    for (; k + 4 <= n; k += 4)
+      {
+	__m256d a1 = _mm256_loadu_pd(al + k), a2 = _mm256_loadu_pd(au + k);
+	__m256d b1 = _mm256_loadu_pd(bl + k), b2 = _mm256_loadu_pd(bu + k);
+	__m256d na1 = neg(a1), na2 = neg(a2);
+	_mm256_storeu_pd(ru + k, max4(_mm256_mul_pd(a1, b1), _mm256_mul_pd(a1, b2), _mm256_mul_pd(a2, b1), _mm256_mul_pd(a2, b2)));
+	_mm256_storeu_pd(rl + k, neg(max4(_mm256_mul_pd(na1, b1), _mm256_mul_pd(na1, b2), _mm256_mul_pd(na2, b1), _mm256_mul_pd(na2, b2))));
+      }
+#endif
+    for (; k < n; k++)
+      {
+	ru[k] = max4(al[k]*bl[k], al[k]*bu[k], au[k]*bl[k], au[k]*bu[k]);
+	rl[k] = -max4((-al[k])*bl[k], (-al[k])*bu[k], (-au[k])*bl[k], (-au[k])*bu[k]);
+      }
+  }
+
+  static void minus(int n, const double* al, const double* au, double* rl, double* ru)
+  {
+    for (int k = 0; k < n; k++)
+      {
+	rl[k] = -au[k];
+	ru[k] = -al[k];
+      }
+  }
+
+  static void sqr(int n, const double* al, const double* au, double* rl, double* ru)
+  {
+    int k = 0;
+#if defined(__AVX2__)
+    const __m256d zero = _mm256_setzero_pd();
+    for (; k + 4 <= n; k += 4)
+      {
+	__m256d a1 = _mm256_loadu_pd(al + k), a2 = _mm256_loadu_pd(au + k);
+	_mm256_storeu_pd(ru + k, _mm256_max_pd(_mm256_mul_pd(a1, a1), _mm256_mul_pd(a2, a2)));
+	__m256d lb_pos = neg(_mm256_mul_pd(neg(a1), a1));   // a1*a1 rounded downward, when 0 <= a1
+	__m256d lb_neg = neg(_mm256_mul_pd(neg(a2), a2));   // a2*a2 rounded downward, when a2 <= 0
+	__m256d lb = _mm256_blendv_pd(zero, lb_neg, _mm256_cmp_pd(a2, zero, _CMP_LE_OQ));
+	_mm256_storeu_pd(rl + k, _mm256_blendv_pd(lb, lb_pos, _mm256_cmp_pd(a1, zero, _CMP_GE_OQ)));
+      }
+#endif
+    for (; k < n; k++)
+      {
+	ru[k] = max(al[k]*al[k], au[k]*au[k]);
+	if (al[k] >= 0.)
+	  rl[k] = -((-al[k])*al[k]);
+	else if (au[k] <= 0.)
+	  rl[k] = -((-au[k])*au[k]);
+	else
+	  rl[k] = 0.;
+      }
+  }
+
+  //  ------------------------------------------------------ EVALUATION ------------------------------------------------------
+
+  void TFunctionBatch::eval(int nb, const double* const* arg_lb, const double* const* arg_ub,
+			    double* const* img_lb, double* const* img_ub, char* valid) const
+  {
+    assert(m_compiled);
+    int block = m_block_size;
+    vector<double> work_lb(m_tape.size() * block), work_ub(m_tape.size() * block);
+    vector<const double*> reg_lb(m_nb_regs), reg_ub(m_nb_regs);
+    for (size_t q = 0; q < m_tape.size(); q++)
+      {
+	reg_lb[m_nb_arg + q] = &work_lb[q * block];
+	reg_ub[m_nb_arg + q] = &work_ub[q * block];
+      }
+
+    int rounding = fegetround();
+    fesetround(FE_UPWARD);
+    for (int k0 = 0; k0 < nb; k0 += block)
+      {
+	int len = min(block, nb - k0);
+	for (int j = 0; j < m_nb_arg; j++)
+	  {
+	    reg_lb[j] = arg_lb[j] + k0;
+	    reg_ub[j] = arg_ub[j] + k0;
+	  }
+
+	for (size_t q = 0; q < m_tape.size(); q++)
+	  {
+	    const Instruction& ins = m_tape[q];
+	    double* rl = &work_lb[q * block];
+	    double* ru = &work_ub[q * block];
+	    switch (ins.op)
+	      {
+	      case CONST:
+		fill(rl, rl + len, ins.lb); fill(ru, ru + len, ins.ub);
+		break;
+	      case ADD:
+		add(len, reg_lb[ins.a], reg_ub[ins.a], reg_lb[ins.b], reg_ub[ins.b], rl, ru);
+		break;
+	      case SUB:
+		sub(len, reg_lb[ins.a], reg_ub[ins.a], reg_lb[ins.b], reg_ub[ins.b], rl, ru);
+		break;
+	      case MUL:
+		mul(len, reg_lb[ins.a], reg_ub[ins.a], reg_lb[ins.b], reg_ub[ins.b], rl, ru);
+		break;
+	      case MINUS:
+		minus(len, reg_lb[ins.a], reg_ub[ins.a], rl, ru);
+		break;
+	      case SQR:
+		sqr(len, reg_lb[ins.a], reg_ub[ins.a], rl, ru);
+		break;
+	      }
+	  }
+
+	for (size_t i = 0; i < m_outputs.size(); i++)
+	  {
+	    copy(reg_lb[m_outputs[i]], reg_lb[m_outputs[i]] + len, img_lb[i] + k0);
+	    copy(reg_ub[m_outputs[i]], reg_ub[m_outputs[i]] + len, img_ub[i] + k0);
+	  }
+      }
+    fesetround(rounding);
+
+    for (int k = 0; k < nb; k++)
+      {
+	bool ok = true;
+	for (int j = 0; j < m_nb_arg && ok; j++)   // false for an unbounded, empty or NaN argument
+	  ok = std::isfinite(arg_lb[j][k]) && std::isfinite(arg_ub[j][k]) && arg_lb[j][k] <= arg_ub[j][k];
+	for (size_t i = 0; i < m_outputs.size() && ok; i++)
+	  ok = img_lb[i][k] == img_lb[i][k] && img_ub[i][k] == img_ub[i][k];
+	valid[k] = ok;
+      }
+  }
+}
@@ -0,0 +1,72 @@
+/* ============================================================================
+ *  tubex-lib - TFunctionBatch class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#ifndef __TUBEX_TFUNCTIONBATCH_H__
+#define __TUBEX_TFUNCTIONBATCH_H__
+
+#include <vector>
+#include <map>
+#include "ibex_Expr.h"
+#include "tubex_TFunction.h"
+
+namespace tubex
+{
+  /* Evaluation of a TFunction on many boxes at once (the slices of a derivative tube, see DerivativeCache).
+     The expression of the function is compiled into a sequence of interval operations (+, -, *, unary -, sqr),
+     each one applied to blocks of boxes stored as arrays of bounds (one array per argument and per bound),
+     with vectorized kernels (AVX2 when the compiler targets it, scalar loops otherwise).
+     The bounds are computed with the rounding mode set upward : an upper bound is rounded upward,
+     a lower bound is the opposite of an upward rounded computation, so the result encloses the exact range
+     (natural interval extension, as TFunction::eval_vector).
+     A function using another operator is not compiled (is_compiled() false) : it has to be evaluated by f itself.
+     The evaluation only reads the compiled expression : it can be done by several threads at the same time. */
+  class TFunctionBatch
+  {
+  public:
+
+      TFunctionBatch(const TFunction& f);
+
+      bool is_compiled() const;
+      /* number of arguments (t first, then the variables) and of components of the image */
+      int nb_arg() const;
+      int image_dim() const;
+
+      /* evaluates the nb boxes arg_lb[j][k], arg_ub[j][k] (j : argument, k : box) into img_lb[i][k], img_ub[i][k] (i : component).
+         valid[k] is set to 0 for a box whose bounds are not finite or empty, or whose result is not defined :
+         that box has to be evaluated by f */
+      void eval(int nb, const double* const* arg_lb, const double* const* arg_ub,
+		double* const* img_lb, double* const* img_ub, char* valid) const;
+
+  protected:
+
+      enum Op { CONST, ADD, SUB, MUL, MINUS, SQR };
+      struct Instruction
+      {
+	Op op;
+	int a, b;        // operand registers
+	double lb, ub;   // constant
+      };
+
+      int compile(const ibex::ExprNode& e);
+
+      bool m_compiled = true;
+      int m_nb_arg;
+      int m_nb_regs;   // the first nb_arg registers are the arguments, then one register per instruction
+      std::vector<Instruction> m_tape;
+      std::vector<int> m_outputs;  // register of each component
+      std::map<const ibex::ExprNode*, int> m_regs;  // during the compilation : shared subexpressions
+      /* Internal parameter : number of boxes of a block (the registers of a block stay in cache) */
+      int m_block_size = 256;
+  };
+}
+
+#endif
@@ -0,0 +1,118 @@
+/* ============================================================================
+ *  tubex-lib - ThreadPool class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#include "tubex_ThreadPool.h"
+
+using namespace std;
+
+namespace tubex
+{
+  ThreadPool::ThreadPool(int nb_threads)
+  {
+    if (nb_threads <= 0)
+      nb_threads = thread::hardware_concurrency();
+    for (int w = 1; w < nb_threads; w++)
+      m_threads.push_back(thread(&ThreadPool::work, this, w));
+  }
+
+  ThreadPool::~ThreadPool()
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv_start.notify_all();
+    for (size_t w = 0; w < m_threads.size(); w++)
+      m_threads[w].join();
+  }
+
+  int ThreadPool::nb_threads() const
+  {
+    return m_threads.size() + 1;
+  }
+
+  void ThreadPool::run(int nb_tasks, const function<void(int,int)>& task)
+  {
+    if (m_threads.empty() || nb_tasks <= 1){ // nothing to share
+      for (int i = 0; i < nb_tasks; i++)
+	task(i, 0);
+      return;
+    }
+
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_task = &task;
+      m_nb_tasks = nb_tasks;
+      m_next_task = 0;
+      m_running = m_threads.size();
+      m_exception = exception_ptr();
+      m_generation++;
+    }
+    m_cv_start.notify_all();
+
+    execute(0); // the calling thread works too
+
+    exception_ptr e;
+    {
+      unique_lock<mutex> lock(m_mutex);
+      m_cv_done.wait(lock, [this]{ return m_running == 0; });
+      m_task = NULL;
+      e = m_exception;
+    }
+    if (e)
+      rethrow_exception(e);
+  }
+
+  void ThreadPool::work(int worker)
+  {
+    unsigned long generation = 0;
+    while (true)
+      {
+	{
+	  unique_lock<mutex> lock(m_mutex);
+	  m_cv_start.wait(lock, [this, generation]{ return m_stop || m_generation != generation; });
+	  if (m_stop) return;
+	  generation = m_generation;
+	}
+
+	execute(worker);
+
+	{
+	  lock_guard<mutex> lock(m_mutex);
+	  m_running--;
+	  if (m_running == 0)
+	    m_cv_done.notify_one();
+	}
+      }
+  }
+
+  // takes the tasks of the current run one by one until there is none left
+  void ThreadPool::execute(int worker)
+  {
+    while (true)
+      {
+	int i;
+	{
+	  lock_guard<mutex> lock(m_mutex);
+	  if (m_next_task >= m_nb_tasks) return;
+	  i = m_next_task++;
+	}
+	try
+	  { (*m_task)(i, worker); }
+	catch (...)
+	  {
+	    lock_guard<mutex> lock(m_mutex);
+	    if (!m_exception) m_exception = current_exception();
+	  }
+      }
+  }
+}
@@ -0,0 +1,65 @@
+/* ============================================================================
+ *  tubex-lib - ThreadPool class
+ * ============================================================================
+ *  Copyright : Copyright 2017 Simon Rohou
+ *  License   : This program is distributed under the terms of
+ *              the GNU Lesser General Public License (LGPL).
+ *
+ *  Author(s) : Bertrand Neveu
+ *  Bug fixes : -
+ *  Created   : 2020
+ * ---------------------------------------------------------------------------- */
+
+#ifndef __TUBEX_THREADPOOL_H__
+#define __TUBEX_THREADPOOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+namespace tubex
+{
+  /* A fixed set of worker threads used by the solver for its parallel parts
+     (time segments, batches of problems, ...).
+     The thread calling run() takes part in the work as worker 0, so a pool
+     of 1 thread creates no thread at all and runs the tasks sequentially. */
+  class ThreadPool
+  {
+  public:
+
+      /* nb_threads : number of workers (calling thread included), 0 for the number of cores */
+      ThreadPool(int nb_threads);
+      ~ThreadPool();
+
+      int nb_threads() const;
+
+      /* runs task(i, worker) for every i in [0, nb_tasks) and returns when all tasks are done.
+         worker, in [0, nb_threads()), identifies the thread running the task : it can be used
+         to index per-thread data. The first exception thrown by a task is rethrown here.
+         run must not be called from inside a task. */
+      void run(int nb_tasks, const std::function<void(int,int)>& task);
+
+  protected:
+
+      void work(int worker);
+      void execute(int worker);
+
+      std::vector<std::thread> m_threads;
+      std::mutex m_mutex;
+      std::condition_variable m_cv_start;
+      std::condition_variable m_cv_done;
+
+      const std::function<void(int,int)>* m_task = NULL;
+      int m_nb_tasks = 0;
+      int m_next_task = 0;
+      int m_running = 0;               // number of helper threads still working on the current run
+      unsigned long m_generation = 0;  // incremented at each run to wake up the helpers
+      bool m_stop = false;
+      std::exception_ptr m_exception;
+  };
+}
+
+#endif